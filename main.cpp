@@ -6,6 +6,12 @@
 #include "utils/public_camera.h"
 #include "utils/public_image.h"
 #include "utils/blocks.h"
+#include "utils/profiler.h"
+#include "utils/logger.h"
+#include "utils/presenter.h"
+#include "utils/dynamic_resolution.h"
+#include "utils/interleaved.h"
+#include "utils/gbuffer.h"
 
 #include <cstdio>
 #include <cstring>
@@ -20,6 +26,17 @@
 #include <bitset>
 
 #include "utils/voxel_octree.h"
+#include "utils/terrain.h"
+#include "utils/sdf_scene.h"
+#include "utils/voxelizer.h"
+#include "utils/chunk_mesher.h"
+#include "utils/triangle_bvh.h"
+#include "utils/voxel_instances.h"
+#include "utils/voxel_ao.h"
+#include "utils/light_engine.h"
+#include "utils/cone_tracing.h"
+#include "utils/progressive.h"
+#include "utils/frame_cache.h"
 
 using LiteMath::float2;
 using LiteMath::float3;
@@ -39,6 +56,19 @@ int SCREEN_WIDTH  = 800;
 int SCREEN_HEIGHT = 600;
 
 int texture_size = 16;
+const int IDLE_WAIT_MS = 100;   // longest sleep between input checks while the frame is unchanged
+
+float3 sun_direction = float3(-1, 1.4, 0.2);
+FaceLighting face_lighting;
+MeshScene mesh_scene;
+TerrainGenerator terrain;
+SparseOctree world_tree;          // storage behind world_octree / octree_far
+OctreeAO world_ao;                // baked AO of world_octree, see voxel_ao.h
+LightEngine light_engine;
+ConeTracer cone_tracer;
+VoxelScene voxel_scene;
+BlueNoise blue_noise;
+ProgressiveAccumulator progressive;
 
 float rad_to_deg(float rad) { return rad * 180.0f / PI; }
 
@@ -59,14 +89,14 @@ float scene_distance(float3 p)
 
 using LiteMath::float3, LiteMath::float2;
 
-float2 normalize_screen_offset(int x, int y, const int W, const int H) {
+float2 normalize_screen_offset(float x, float y, const int W, const int H) {
     float dx = float(x - W / 2) / (W / 2);
     float dy = float(H / 2 - y) / (H / 2);
     return float2(dx, dy);
 }
 
 
-float3 screen_offset(float3 dir, int x, int y, const int W, const int H) {
+float3 screen_offset(float3 dir, float x, float y, const int W, const int H) {
     float2 dv = normalize_screen_offset(x, y, W, H);
 
     float2 offset = float2(
@@ -83,6 +113,26 @@ float3 screen_offset(float3 dir, int x, int y, const int W, const int H) {
 }
 
 
+// Inverse of screen_offset: continuous pixel coordinates of a world point, false if it is behind the camera
+bool world_to_screen(const Camera &camera, float3 p, const int W, const int H, float2 &out_xy) {
+    float3 world_up = float3(0, 1, 0);
+    float3 right = normalize(cross(world_up, camera.dir));
+    float3 up = normalize(cross(camera.dir, right));
+
+    float3 v = p - camera.pos;
+    float forward = dot(v, camera.dir);
+    if (forward <= 1e-4f)
+        return false;
+
+    float2 dv = float2(
+        dot(v, right) / forward / tan(LiteMath::M_PI / 2 * 0.5f),
+        dot(v, up) / forward / tan(LiteMath::M_PI / 3 * 0.5f)
+    );
+    out_xy = float2(dv.x * (W / 2) + W / 2, H / 2 - dv.y * (H / 2));
+    return true;
+}
+
+
 int voxel_trace_dda(const float3& ro, const float3& rd, float max_t, int3& out_voxel, float3& out_normal, float3& out_hit_point)
 {
     int3 voxel = int3(floor(ro.x), floor(ro.y), floor(ro.z));
@@ -159,51 +209,317 @@ int voxel_trace_dda(const float3& ro, const float3& rd, float max_t, int3& out_v
     return 0;
 }
 
-void render(const Camera &camera, uint32_t *out_image, int W, int H, VoxelTexture *voxel_textures)
+struct SurfaceHit {
+    int id;
+    float dist;
+    float3 normal;
+    float2 uv;      // position on the hit face in voxel units, see TextureAtlas::face_uv
+    int face;       // index into face_normal
+    float ao;       // baked ambient occlusion shade factor
+    float light;    // sky / block light shade factor of the voxel in front of the face
+};
+
+// Nearest surface of the world, meshes and voxel instances, everything but light
+bool trace_geometry(const float3 &ro, const float3 &rd, SurfaceHit &hit)
 {
-    float3 light_source = normalize(float3(-1, 1.4, 0.2));
-    float ray_length = 100;
-    
+    int3 voxel_pos;
+    int voxel_size;
+    int leaf;
+
+    int3 world_pos = int3(-WORLD_SIZE / 2);
+    bool voxel_hit = (hit.id = traverse_octree(ro, rd, 0, WORLD_SIZE, world_pos, hit.dist, voxel_pos, voxel_size, hit.face, &leaf)) >= 1;
+
+    // instances only need to be tested up to the nearest hit so far
+    InstanceHit instance_hit;
+    float t_max = voxel_hit ? hit.dist : SKY_DEPTH;
+    bool mesh_hit = mesh_scene.intersect(ro, rd, t_max, instance_hit);
+    if (mesh_hit)
+        t_max = instance_hit.t;
+    if (voxel_scene.intersect(ro, rd, t_max, instance_hit) || mesh_hit) {
+        hit.id = instance_hit.block_id;
+        hit.dist = instance_hit.t;
+        hit.normal = instance_hit.normal;
+        hit.face = instance_hit.face;
+        hit.ao = instance_hit.ao;
+        hit.uv = instance_hit.uv - floor(instance_hit.uv);
+        return true;
+    }
+    if (!voxel_hit)
+        return false;
+
+    // the face comes from the slab test, so the hit point lies exactly on it and only the two
+    // in-plane coordinates are needed
+    float3 local = ro + rd * hit.dist - float3(voxel_pos);
+    hit.normal = face_normal[hit.face];
+    hit.uv = TextureAtlas::face_uv(local, hit.face);
+    hit.ao = world_ao.empty() ? 1.0f : world_ao.sample(leaf, hit.face, hit.uv, voxel_size);
+    hit.uv = hit.uv - floor(hit.uv);
+    return true;
+}
+
+// Nearest voxel surface along the ray, false on a miss
+bool trace_surface(const float3 &ro, const float3 &rd, SurfaceHit &hit)
+{
+    if (!trace_geometry(ro, rd, hit))
+        return false;
+    float3 front = ro + rd * hit.dist + hit.normal * 0.5f;
+    hit.light = light_engine.shade(int3((int)floor(front.x), (int)floor(front.y), (int)floor(front.z)));
+    return true;
+}
+
+// World units covered by one pixel at unit distance, see screen_offset
+float pixel_spread(int W) { return tan(LiteMath::M_PI / 2 * 0.5f) / (W / 2); }
+
+// Traces a single primary ray, returns the packed colour and the hit distance (SKY_DEPTH on a miss)
+uint32_t trace_pixel(const Camera &camera, int x, int y, int W, int H, const TextureAtlas &atlas, float &depth)
+{
+    float3 cur_dir = screen_offset(camera.dir, x, y, W, H);
+    float3 color = float3(0.1f, 0.1f, 0.1f); // фон
+    SurfaceHit hit;
+    depth = SKY_DEPTH;
+
+    if (trace_surface(camera.pos, cur_dir, hit)) {
+        float lod = atlas.lod(hit.dist, pixel_spread(W), dot(cur_dir, hit.normal));
+        float3 shade = float3(face_lighting.shade[hit.face] * hit.ao * hit.light);
+        if (cone_tracer.enabled) {
+            // cone traced sky visibility replaces the baked AO and adds one soft bounce; the bounce
+            // carries the light reaching this point too, so unlit caves stay dark
+            float visibility;
+            float3 indirect;
+            cone_tracer.ambient(camera.pos + cur_dir * hit.dist, hit.normal, visibility, indirect);
+            shade = float3(face_lighting.shade[hit.face] * visibility * hit.light) + indirect * hit.light;
+        }
+        color = atlas.get_color(hit.id, hit.face, hit.uv, lod) * shade;
+        depth = std::max(hit.dist, 0.0f);
+        //color = float3(1);
+    }
+    return float3_to_RGBA8(color);
+}
+
+// Any surface closer than t_max, for shadow rays
+bool occluded(const float3 &ro, const float3 &rd, float t_max)
+{
+    int3 world_pos = int3(-WORLD_SIZE / 2);
+    return traverse_octree_any(ro, rd, 0, WORLD_SIZE, world_pos, t_max) || mesh_scene.occluded(ro, rd, t_max) ||
+           voxel_scene.occluded(ro, rd, t_max);
+}
+
+const int PATH_BOUNCES = 4;
+const float3 SUN_RADIANCE = float3(1.0f, 0.95f, 0.85f);
+
+float3 sky_radiance(const float3 &dir)
+{
+    float t = std::clamp(dir.y * 0.5f + 0.5f, 0.0f, 1.0f);
+    return float3(0.75f, 0.8f, 0.85f) * (1.0f - t) + float3(0.35f, 0.5f, 0.8f) * t;
+}
+
+// One path through pixel (x, y): diffuse bounces with cosine sampling, and at every hit a shadow ray
+// to the sun. Dimensions 0 and 1 jitter the pixel, every bounce takes 3 more (direction, roulette).
+float3 trace_path(const Camera &camera, int x, int y, int index, int W, int H, const TextureAtlas &atlas)
+{
+    auto rnd = [&](int dim) { return blue_noise.sample(x, y, index, dim); };
+    float3 ro = camera.pos;
+    float3 rd = screen_offset(camera.dir, x + rnd(0) - 0.5f, y + rnd(1) - 0.5f, W, H);
+    float3 sun = normalize(sun_direction);
+    float3 radiance = float3(0.0f), throughput = float3(1.0f);
+
+    for (int bounce = 0; bounce < PATH_BOUNCES; ++bounce) {
+        SurfaceHit hit;
+        if (!trace_geometry(ro, rd, hit)) {
+            radiance += throughput * sky_radiance(rd);
+            break;
+        }
+        float3 albedo = atlas.get_color(hit.id, hit.face, hit.uv, 0.0f);
+        float3 p = ro + rd * hit.dist + hit.normal * 1e-3f;
+        float ndl = dot(hit.normal, sun);
+        if (ndl > 0.0f && !occluded(p, sun, SKY_DEPTH))
+            radiance += throughput * albedo * SUN_RADIANCE * ndl;
+
+        // cosine weighted bounce, the pdf cancels the cosine and 1/pi of the lambertian brdf
+        throughput *= albedo;
+        float u1 = rnd(2 + 3 * bounce), u2 = rnd(3 + 3 * bounce);
+        float r = sqrt(u1), phi = 2.0f * LiteMath::M_PI * u2;
+        float3 tangent = normalize(cross(hit.normal, std::abs(hit.normal.y) < 0.99f ? float3(0, 1, 0) : float3(1, 0, 0)));
+        float3 bitangent = cross(hit.normal, tangent);
+        rd = normalize(tangent * (r * cos(phi)) + bitangent * (r * sin(phi)) + hit.normal * sqrt(std::max(0.0f, 1.0f - u1)));
+        ro = p;
+
+        if (bounce >= 1) {
+            float survive = std::min(0.95f, std::max(throughput.x, std::max(throughput.y, throughput.z)));
+            if (rnd(4 + 3 * bounce) >= survive)
+                break;
+            throughput = throughput / survive;
+        }
+    }
+    return radiance;
+}
+
+// Deferred trace pass over the pixels of rect: writes the G-buffer only, render_deferred shades it
+// afterwards with shade_gbuffer
+void trace_gbuffer(const Camera &camera, GBuffer &gbuffer, const TextureAtlas &atlas, const ScreenRect &rect)
+{
+    const int W = gbuffer.width;
+    const int H = gbuffer.height;
+    const float spread = pixel_spread(W);
+
     #pragma omp parallel for collapse(2)
-    for (int y = 0; y < H; y++)
+    for (int y = rect.y0; y < rect.y1; y++)
     {
-        for (int x = 0; x < W; x++)
+        for (int x = rect.x0; x < rect.x1; x++)
         {
+            int i = y*W + x;
             float3 cur_dir = screen_offset(camera.dir, x, y, W, H);
-            float3 color = float3(0.1f, 0.1f, 0.1f); // фон
-            float3 normal;
-            int3 voxel_pos;
-            int voxel_size;
-            
-            int id;
-            float dist;
-
-            int3 world_pos = int3(-WORLD_SIZE / 2);
-            if ((id = traverse_octree(camera.pos, cur_dir, 0, WORLD_SIZE, world_pos, dist, voxel_pos, voxel_size)) >= 1) {
-                float3 hit_point = camera.pos + cur_dir * dist;
-                float3 local = hit_point - float3(voxel_pos);
-                
-                // Определяем, какая грань ближе всего к точке пересечения
-                float3 to_center = local - float3(voxel_size) * 0.5f; // вектор к центру вокселя
-                float3 abs_to_center = LiteMath::abs(to_center);
-                
-                // Находим грань с максимальным отклонением от центра
-                if (abs_to_center.x >= abs_to_center.y && abs_to_center.x >= abs_to_center.z) {
-                    normal = float3(LiteMath::sign(to_center.x), 0, 0);
-                } else if (abs_to_center.y >= abs_to_center.z) {
-                    normal = float3(0, LiteMath::sign(to_center.y), 0);
-                } else {
-                    normal = float3(0, 0, LiteMath::sign(to_center.z));
-                }
-                
-                color = voxel_textures[id - 1].get_color(local, normal);
-                //color = float3(1);
+            SurfaceHit hit;
+            if (!trace_surface(camera.pos, cur_dir, hit)) {
+                gbuffer.block[i] = 0;
+                gbuffer.depth[i] = SKY_DEPTH;
+                continue;
             }
-            out_image[y*W + x] = float3_to_RGBA8(color);
+            float lod = atlas.lod(hit.dist, spread, dot(cur_dir, hit.normal));
+            gbuffer.block[i] = hit.id;
+            gbuffer.face[i] = hit.face;
+            gbuffer.level[i] = std::min(int(lod), atlas.mip_levels - 1);
+            gbuffer.u[i] = std::min(int(hit.uv.x * 256.0f), 255);
+            gbuffer.v[i] = std::min(int(hit.uv.y * 256.0f), 255);
+            float ambient = hit.ao;
+            if (cone_tracer.enabled) {
+                // the G-buffer has no colour plane for the bounce, only the visibility is kept
+                float3 indirect;
+                cone_tracer.ambient(camera.pos + cur_dir * hit.dist, hit.normal, ambient, indirect);
+            }
+            gbuffer.ambient[i] = std::min(int(ambient * hit.light * 256.0f), 255);
+            gbuffer.depth[i] = std::max(hit.dist, 0.0f);
+        }
+    }
+}
+
+// The G-buffer outside rects is kept from the previous frame; all rects are traced first and the
+// rows they cover are shaded once
+void render_deferred(const Camera &camera, GBuffer &gbuffer, uint32_t *out_image, int W, int H, const TextureAtlas &atlas,
+                     const std::vector<ScreenRect> &rects)
+{
+    gbuffer.resize(W, H);
+    std::vector<uint8_t> rows(H, 0);
+    for (const ScreenRect &rect : rects)
+    {
+        trace_gbuffer(camera, gbuffer, atlas, rect);
+        std::fill(rows.begin() + rect.y0, rows.begin() + rect.y1, 1);
+    }
+    shade_gbuffer(gbuffer, atlas, face_lighting, float3_to_RGBA8(float3(0.1f, 0.1f, 0.1f)), rows, out_image);
+}
+
+// Traces the pixels of rect, the rest of out_image is left as it is
+void render(const Camera &camera, uint32_t *out_image, int W, int H, const TextureAtlas &atlas, const ScreenRect &rect)
+{
+    #pragma omp parallel for collapse(2)
+    for (int y = rect.y0; y < rect.y1; y++)
+    {
+        for (int x = rect.x0; x < rect.x1; x++)
+        {
+            float depth;
+            out_image[y*W + x] = trace_pixel(camera, x, y, W, H, atlas, depth);
         }
     }
 }
 
+// Adds one path traced sample per pixel while the camera is still and shows the running mean
+void render_progressive(const Camera &camera, uint32_t *out_image, int W, int H, const TextureAtlas &atlas)
+{
+    if (blue_noise.mask.empty())
+        blue_noise.generate();
+    progressive.begin(W, H, camera.pos, camera.dir);
+    if (!progressive.converged) {
+        progressive.add_sample([&](int x, int y, int index) { return trace_path(camera, x, y, index, W, H, atlas); });
+        if (progressive.converged)
+            LOG_INFO("Progressive image converged: {} samples, error {%.4f}", progressive.samples, progressive.error);
+    }
+    progressive.resolve(out_image);
+}
+
+// Traces only this frame's subset of pixels and reconstructs the rest from the previous frame
+void render_interleaved(InterleavedHistory &history, InterleaveMode mode, const Camera &camera, uint32_t *out_image,
+                        int W, int H, const TextureAtlas &atlas)
+{
+    auto trace = [&](int x, int y, float &depth) { return trace_pixel(camera, x, y, W, H, atlas, depth); };
+    auto ray_dir = [&](const Camera &cam, int x, int y) { return screen_offset(cam.dir, x, y, W, H); };
+    auto project = [&](const Camera &cam, float3 p, float2 &xy) { return world_to_screen(cam, p, W, H, xy); };
+    interleaved_render(history, mode, camera, out_image, W, H, trace, ray_dir, project);
+}
+
+
+// Scatters count instances of one small voxel tree on a grid around the origin with random yaw
+void add_voxel_forest(int count)
+{
+  const int size = 16;
+  SdfScene tree;
+  int trunk = tree.capsule(float3(8, 0, 8), float3(8, 10, 8), 1.5f, OAK);
+  int crown = tree.sphere(float3(8, 11, 8), 4.5f, GRASS);
+  tree.unite(trunk, crown);
+  SparseOctree octree;
+  SdfChunkBuilder builder{tree, int3(0, 0, 0), size};
+  build_SO_from_dummy(&octree, builder.build(size, int3(0, 0, 0)));
+  int model = voxel_scene.add_model(std::move(octree), size);
+
+  int side = (int)ceil(sqrt((float)count));
+  for (int i = 0; i < count; ++i) {
+    float3 pos = float3((i % side - side / 2) * 20.0f, 0.0f, (i / side - side / 2) * 20.0f);
+    float yaw = (rand() % 360) * (float)PI / 180.0f;
+    voxel_scene.add_instance(model, LiteMath::translate4x4(pos) * LiteMath::rotate4x4Y(yaw) *
+                                    LiteMath::translate4x4(float3(-size / 2, 0, -size / 2)));
+  }
+}
+
+// The one way to change a block of the world after it was built: the octree is edited in place, its
+// AO and the cone prefilter are refreshed around the block and the light engine relights it on its
+// next update(). False outside the world.
+bool set_world_block(int3 p, int block_id)
+{
+  int3 local = p + int3(WORLD_SIZE / 2);
+  if (local.x < 0 || local.y < 0 || local.z < 0 || local.x >= WORLD_SIZE || local.y >= WORLD_SIZE || local.z >= WORLD_SIZE)
+    return false;
+  int first_new = (int)world_tree.nodes.size();
+  std::vector<int> path;
+  bool compacted = false;
+  if (!octree_set_block(&world_tree, WORLD_SIZE, local, block_id, path))
+  {
+    // the far table filled up with the nodes added by earlier edits
+    compact_octree(&world_tree);
+    compacted = true;
+    if (!octree_set_block(&world_tree, WORLD_SIZE, local, block_id, path))
+      return false;
+  }
+  world_octree = world_tree.nodes.data();
+  octree_far = world_tree.far.data();
+  world_octree_len = (int)world_tree.nodes.size();
+  if (compacted)
+  {
+    bake_octree_ao(world_octree, octree_far, world_octree_len, WORLD_SIZE, world_ao);
+    cone_tracer.refilter(world_octree, octree_far, world_octree_len);
+  }
+  else
+  {
+    update_octree_ao(world_octree, octree_far, world_octree_len, WORLD_SIZE, local, first_new, world_ao);
+    cone_tracer.update(world_octree, octree_far, world_octree_len, path);
+  }
+  light_engine.set_block(p, block_id);
+  return true;
+}
+
+// World voxel under the screen centre and the empty voxel in front of it, false if the ray misses
+bool pick_world_block(const Camera &camera, int3 &block, int3 &front)
+{
+  float dist;
+  int3 voxel_pos;
+  int voxel_size, face;
+  int3 world_pos = int3(-WORLD_SIZE / 2);
+  if (traverse_octree(camera.pos, camera.dir, 0, WORLD_SIZE, world_pos, dist, voxel_pos, voxel_size, face) < 1)
+    return false;
+  float3 hit = camera.pos + camera.dir * dist;
+  float3 inside = hit - face_normal[face] * 0.5f, outside = hit + face_normal[face] * 0.5f;
+  block = int3((int)floor(inside.x), (int)floor(inside.y), (int)floor(inside.z));
+  front = int3((int)floor(outside.x), (int)floor(outside.y), (int)floor(outside.z));
+  return true;
+}
 
 void printBinary(int num, FILE *out) {
     for (int i = 31; i >= 0; i--) {
@@ -215,10 +531,70 @@ void printBinary(int num, FILE *out) {
 // You must include the command line parameters for your main function to be recognized by SDL
 int main(int argc, char **args)
 {
+  // --profile <prefix> writes <prefix>.csv and <prefix>.json with per-stage frame timings on exit
+  // --log-level <trace|debug|info|warn|error|off> filters log records before they are queued
+  // --frame-budget <ms> target render time for dynamic resolution, 0 renders at window resolution
+  // --interleave <off|checker|2x2> traces a subset of pixels per frame and reconstructs the rest (F2 cycles)
+  // --build-texture-pack decodes the block textures, writes textures/pack.bin and exits
+  // --deferred traces into a G-buffer and shades it in a separate pass (F3 toggles)
+  // --progressive accumulates path traced samples while the camera is still, until converged (F5 toggles)
+  // --cone-ambient shades with cone traced ambient light and one bounce instead of the baked AO (F4 toggles)
+  // --voxel-forest <n> places n instances of one voxel tree model around the origin
+  // --mesh <file.obj> adds an OBJ mesh at the origin, traced together with the voxel world (repeatable)
+  const char *profile_prefix = nullptr;
+  bool deferred = false;
+  bool progressive_mode = false;
+  InterleaveMode interleave_mode = INTERLEAVE_OFF;
+  ResolutionController resolution;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(args[i], "--profile") == 0 && i + 1 < argc)
+      profile_prefix = args[++i];
+    else if (strcmp(args[i], "--log-level") == 0 && i + 1 < argc)
+      logger.min_level = parse_log_level(args[++i]);
+    else if (strcmp(args[i], "--frame-budget") == 0 && i + 1 < argc)
+      resolution.budget_ms = atof(args[++i]);
+    else if (strcmp(args[i], "--interleave") == 0 && i + 1 < argc)
+    {
+      const char *mode = args[++i];
+      interleave_mode = strcmp(mode, "checker") == 0 ? INTERLEAVE_CHECKERBOARD :
+                        strcmp(mode, "2x2") == 0 ? INTERLEAVE_2X2 : INTERLEAVE_OFF;
+    }
+    else if (strcmp(args[i], "--deferred") == 0)
+      deferred = true;
+    else if (strcmp(args[i], "--cone-ambient") == 0)
+      cone_tracer.enabled = true;
+    else if (strcmp(args[i], "--progressive") == 0)
+      progressive_mode = true;
+    else if (strcmp(args[i], "--voxel-forest") == 0 && i + 1 < argc)
+      add_voxel_forest(atoi(args[++i]));
+    else if (strcmp(args[i], "--mesh") == 0 && i + 1 < argc)
+    {
+      int asset = mesh_scene.load_asset(args[++i]);
+      if (asset >= 0)
+        mesh_scene.add_instance(asset, float4x4());
+    }
+    else if (strcmp(args[i], "--build-texture-pack") == 0)
+    {
+      TextureAtlas atlas;
+      if (!atlas.build())
+        return 1;
+      return atlas.save_pack("textures/pack.bin", TextureAtlas::hash_sources(atlas.collect_sources())) ? 0 : 1;
+    }
+  }
+  logger.start(stdout);
 
   std::cout << "Building octree with world size " << WORLD_SIZE << "...\n";
 
-  build_SO(WORLD_SIZE);
+  {
+    PROFILE_SCOPE(STAGE_WORLD_BUILD);
+    build_SO_world(&world_tree, WORLD_SIZE, terrain);
+    world_octree = world_tree.nodes.data();
+    octree_far = world_tree.far.data();
+    world_octree_len = (int)world_tree.nodes.size();
+    bake_octree_ao(world_octree, octree_far, world_octree_len, WORLD_SIZE, world_ao);
+    light_engine.load_octree(world_octree, octree_far, WORLD_SIZE, int3(-WORLD_SIZE / 2));
+    light_engine.light_all();
+  }
 
   std::cout << "Built octree with length " << world_octree_len << '\n';
   FILE *out = fopen("out.txt", "w");
@@ -226,12 +602,8 @@ int main(int argc, char **args)
     printBinary(world_octree[i], out);
   }
   fclose(out);
-  std::cout << octree_far[0] << '\n';
   
 
-  // Pixel buffer (RGBA format)
-  std::vector<uint32_t> pixels(SCREEN_WIDTH * SCREEN_HEIGHT, 0xFFFFFFFF); // Initialize with white pixels
-  
   // Initialize SDL. SDL_Init will return -1 if it fails.
   if (SDL_Init(SDL_INIT_EVERYTHING) < 0)
   {
@@ -252,29 +624,11 @@ int main(int argc, char **args)
     return 1;
   }
 
-  // Create a renderer
-  SDL_Renderer *renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-  if (!renderer)
-  {
-    std::cerr << "Renderer could not be created! SDL_Error: " << SDL_GetError() << std::endl;
-    SDL_DestroyWindow(window);
-    SDL_Quit();
-    return 1;
-  }
-
-
-  // Create a texture
-  SDL_Texture *texture = SDL_CreateTexture(
-      renderer,
-      SDL_PIXELFORMAT_ARGB8888,    // 32-bit RGBA format
-      SDL_TEXTUREACCESS_STREAMING, // Allows us to update the texture
-      SCREEN_WIDTH,
-      SCREEN_HEIGHT);
-
-  if (!texture)
+  // Renderer, streaming texture and present stay on this thread, the pixel copy runs on the presenter's worker
+  FramePresenter presenter;
+  if (!presenter.start(window, SCREEN_WIDTH, SCREEN_HEIGHT))
   {
-    std::cerr << "Texture could not be created! SDL_Error: " << SDL_GetError() << std::endl;
-    SDL_DestroyRenderer(renderer);
+    std::cerr << "Presenter could not be started" << std::endl;
     SDL_DestroyWindow(window);
     SDL_Quit();
     return 1;
@@ -295,16 +649,36 @@ int main(int argc, char **args)
 
   const Uint8* keys = SDL_GetKeyboardState(NULL);
 
+  FrameCache frame_cache;
+  std::vector<ScreenRect> redraw_rects;
+  bool idle = false;            // the last frame was unchanged
+  bool redraw_window = false;   // the window needs the cached frame presented again
+  InterleavedHistory interleaved_history;
+  GBuffer gbuffer;
+  face_lighting.update(sun_direction);
+
   
 
-  VoxelTexture voxel_textures[8];
-  for (int i = 0; i < 8; ++i) {
-    voxel_textures[i].generate_texture(i);
+  TextureAtlas atlas;
+  {
+    PROFILE_SCOPE(STAGE_TEXTURES);
+    atlas.load();
   }
+  cone_tracer.build(world_octree, octree_far, world_octree_len, WORLD_SIZE, int3(-WORLD_SIZE / 2), atlas);
+  LOG_INFO("Texture atlas: {} tiles, {} bytes", atlas.tile_count, atlas.size_in_bytes());
   
   // Main loop
   while (running)
   {
+    if (idle)
+    {
+      // nothing changed last frame: sleep until there is input instead of tracing the same image
+      SDL_WaitEventTimeout(nullptr, IDLE_WAIT_MS);
+      time = std::chrono::high_resolution_clock::now();
+    }
+    profiler.begin_frame();
+    PROFILE_SCOPE(STAGE_FRAME);
+
     //update camera or scene
     prev_time = time;
     time = std::chrono::high_resolution_clock::now();
@@ -314,9 +688,9 @@ int main(int argc, char **args)
     time_from_start += dt;
     frameNum++;
 
-    if (frameNum % 10 == 0)
-      printf("Render time: %f ms\n", 1000.0f*dt);
+    LOG_EVERY_MS(LOG_LEVEL_INFO, 500, "Frame {} time: {%.3f} ms, render scale {%.2f}", frameNum, 1000.0f*dt, resolution.scale);
     // Process keyboard input
+    int64_t input_start = profiler.now_ns();
     while (SDL_PollEvent(&ev) != 0)
     {
       // check event type
@@ -326,6 +700,10 @@ int main(int argc, char **args)
         // shut down
         running = false;
         break;
+      case SDL_WINDOWEVENT:
+        if (ev.window.event == SDL_WINDOWEVENT_EXPOSED)
+          redraw_window = true;
+        break;
       case SDL_KEYDOWN:
         // test keycode
         switch (ev.key.keysym.sym)
@@ -334,10 +712,46 @@ int main(int argc, char **args)
         case SDLK_ESCAPE:
           running = false;
           break;
+        case SDLK_F2:
+          interleave_mode = InterleaveMode((interleave_mode + 1) % 3);
+          interleaved_history.valid = false;
+          LOG_INFO("Interleave mode: {}", (int)interleave_mode);
+          break;
+        case SDLK_F3:
+          deferred = !deferred;
+          LOG_INFO("Deferred shading: {}", (int)deferred);
+          break;
+        case SDLK_F4:
+          cone_tracer.enabled = !cone_tracer.enabled;
+          interleaved_history.valid = false;
+          LOG_INFO("Cone traced ambient: {}", (int)cone_tracer.enabled);
+          break;
+        case SDLK_F5:
+          progressive_mode = !progressive_mode;
+          progressive.width = 0;
+          LOG_INFO("Progressive path tracing: {}", (int)progressive_mode);
+          break;
           // etc
         }
         break;
       
+      case SDL_MOUSEBUTTONDOWN:
+        {
+          // left button breaks the block in the screen centre, right button places cobblestone on it
+          int3 block, front;
+          if (!pick_world_block(camera, block, front))
+            break;
+          int3 p = ev.button.button == SDL_BUTTON_LEFT ? block : front;
+          if (ev.button.button != SDL_BUTTON_LEFT && ev.button.button != SDL_BUTTON_RIGHT)
+            break;
+          if (set_world_block(p, ev.button.button == SDL_BUTTON_LEFT ? EMPTY : COBBLESTONE) && cone_tracer.enabled)
+          {
+            // cones see the block from up to max_dist away
+            frame_cache.mark_dirty(float3(p) - float3(cone_tracer.max_dist), float3(p) + float3(cone_tracer.max_dist + 1.0f));
+          }
+        }
+        break;
+
       case SDL_MOUSEMOTION:
         {
             int dx = -ev.motion.xrel;
@@ -359,10 +773,9 @@ int main(int argc, char **args)
         break;
       }
     }
+    profiler.push(STAGE_INPUT, input_start, profiler.now_ns());
 
-    
-
-    
+    int64_t camera_start = profiler.now_ns();
     float3 forward = normalize(float3(camera.dir.x, 0, camera.dir.z));
     float3 right = normalize(cross(forward, float3(0, 1, 0)));
 
@@ -372,23 +785,108 @@ int main(int argc, char **args)
     if (keys[SDL_SCANCODE_A]) camera.pos += camera.speed * right * dt;
     if (keys[SDL_SCANCODE_SPACE]) camera.pos += float3(0, camera.speed, 0) * dt;
     if (keys[SDL_SCANCODE_LSHIFT]) camera.pos -= float3(0, camera.speed, 0) * dt;
-    std::cout << camera.pos.x << ' ' << camera.pos.y << ' ' << camera.pos.z << '\n';
-    // Render the scene
-    render(camera, pixels.data(), SCREEN_WIDTH, SCREEN_HEIGHT, voxel_textures);
+    profiler.push(STAGE_CAMERA, camera_start, profiler.now_ns());
+    LOG_EVERY_MS(LOG_LEVEL_DEBUG, 100, "Camera position: {} {} {}", camera.pos.x, camera.pos.y, camera.pos.z);
+    // Render the scene into the frame cache while the previous frame is being presented and copy or
+    // upscale it into the back buffer. Below full resolution the frame is traced at render size.
+    int render_w, render_h;
+    resolution.render_size(SCREEN_WIDTH, SCREEN_HEIGHT, render_w, render_h);
+    if (progressive_mode)
+    {
+      // stills are accumulated at window resolution
+      render_w = SCREEN_WIDTH;
+      render_h = SCREEN_HEIGHT;
+    }
 
-    // Update the texture with the pixel buffer
-    SDL_UpdateTexture(texture, nullptr, pixels.data(), SCREEN_WIDTH * sizeof(uint32_t));
+    // refit the instance top levels after this frame's moves and collect what changed in the world
+    mesh_scene.update();
+    voxel_scene.update();
+    light_engine.update();
+    for (int c = 0; c < (int)light_engine.chunks.size(); ++c)
+    {
+      // light of a voxel shows on the faces around it, one voxel outside the chunk
+      int3 base = light_engine.chunks[c]->coord * LIGHT_CHUNK;
+      frame_cache.check_version(c, light_engine.chunks[c]->version, float3(base) - float3(1.0f),
+                                float3(base + int3(LIGHT_CHUNK)) + float3(1.0f));
+    }
+    auto mark_dirty = [&](float3 lo, float3 hi) { frame_cache.mark_dirty(lo, hi); };
+    mesh_scene.tlas.take_changes(mark_dirty);
+    voxel_scene.tlas.take_changes(mark_dirty);
+
+    int settings = (int)progressive_mode | (int)deferred << 1 | (int)cone_tracer.enabled << 2 | (int)interleave_mode << 3;
+    FrameUpdate update = frame_cache.begin(camera, render_w, render_h, settings,
+        [&](float3 p, float2 &xy) { return world_to_screen(camera, p, render_w, render_h, xy); }, redraw_rects);
+    if (update == FRAME_PARTIAL && (progressive_mode || interleave_mode != INTERLEAVE_OFF))
+    {
+      // accumulated samples and interleaved history cannot be patched, both start over
+      progressive.width = 0;
+      interleaved_history.valid = false;
+      frame_cache.restart();
+      update = FRAME_FULL;
+    }
+    uint32_t *target = frame_cache.image.data();
 
-    // Clear the renderer
-    SDL_RenderClear(renderer);
+    int64_t render_start = profiler.now_ns();
+    if (update != FRAME_CACHED)
+    {
+      PROFILE_SCOPE(STAGE_RENDER);
+      if (update == FRAME_PARTIAL)
+      {
+        if (deferred)
+          render_deferred(camera, gbuffer, target, render_w, render_h, atlas, redraw_rects);
+        else
+          for (const ScreenRect &rect : redraw_rects)
+            render(camera, target, render_w, render_h, atlas, rect);
+      }
+      else if (progressive_mode)
+        render_progressive(camera, target, render_w, render_h, atlas);
+      else if (interleave_mode != INTERLEAVE_OFF)
+        render_interleaved(interleaved_history, interleave_mode, camera, target, render_w, render_h, atlas);
+      else if (deferred)
+        render_deferred(camera, gbuffer, target, render_w, render_h, atlas, {ScreenRect{0, 0, render_w, render_h}});
+      else
+        render(camera, target, render_w, render_h, atlas, ScreenRect{0, 0, render_w, render_h});
+
+      // interleaved frames are final once every phase was traced, progressive ones once converged
+      int phases = interleave_mode == INTERLEAVE_2X2 ? 4 : (interleave_mode == INTERLEAVE_CHECKERBOARD ? 2 : 1);
+      frame_cache.end(progressive_mode ? progressive.converged : frame_cache.still_frames >= phases);
+    }
+    if (update == FRAME_FULL && !progressive_mode)
+      resolution.update((profiler.now_ns() - render_start) * 1e-6f);
 
-    // Copy the texture to the renderer
-    SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+    // an unchanged frame is already on screen and only presented again when the window asks for it
+    idle = update == FRAME_CACHED;
+    if (idle && !redraw_window)
+    {
+      // the last submitted frame is only presented by the next submit, show it before going idle
+      presenter.flush();
+      continue;
+    }
+    redraw_window = false;
+    if (render_w != SCREEN_WIDTH || render_h != SCREEN_HEIGHT)
+    {
+      PROFILE_SCOPE(STAGE_UPSCALE);
+      upscale_edge_aware(target, render_w, render_h, presenter.back_buffer(), SCREEN_WIDTH, SCREEN_HEIGHT);
+    }
+    else
+      memcpy(presenter.back_buffer(), target, SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(uint32_t));
+    {
+      PROFILE_SCOPE(STAGE_SUBMIT_WAIT);
+      presenter.submit();
+    }
+  }
+
+  presenter.stop();
 
-    // Update the screen
-    SDL_RenderPresent(renderer);
+  if (profile_prefix) {
+    std::string prefix = profile_prefix;
+    profiler.export_csv((prefix + ".csv").c_str());
+    profiler.export_chrome_trace((prefix + ".json").c_str());
+    profiler.print_summary(stdout);
   }
 
+  logger.stop();
+
   // Destroy the window. This will also destroy the surface
   SDL_DestroyWindow(window);
 
@@ -0,0 +1,54 @@
+// HashFileContents over files shorter than one 32-byte step and around it; run under ASan to catch
+// reads and writes past the tail. Every byte has to change the hash, or edits to it would not
+// invalidate the .meshbin cache.
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "utils/mesh.h"
+
+static bool write_file(const std::string &path, const std::vector<unsigned char> &data)
+{
+  FILE *f = fopen(path.c_str(), "wb");
+  if (!f)
+    return false;
+  bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+  return fclose(f) == 0 && ok;
+}
+
+int main()
+{
+  std::string path = "hash_file_test.bin";
+  int failures = 0;
+  for (size_t size = 1; size <= 40; ++size)
+  {
+    std::vector<unsigned char> data(size);
+    for (size_t i = 0; i < size; ++i)
+      data[i] = (unsigned char)(i * 37 + size);
+    if (!write_file(path, data))
+    {
+      printf("[hash_file_test::ERROR] Failed to write %s\n", path.c_str());
+      return 1;
+    }
+    uint64_t hash = cmesh4::HashFileContents(path.c_str());
+    if (hash == 0 || hash != cmesh4::HashFileContents(path.c_str()))
+    {
+      printf("size %zu: hash is 0 or not deterministic\n", size);
+      failures++;
+    }
+    for (size_t i = 0; i < size; ++i)
+    {
+      data[i] ^= 0x5a;
+      write_file(path, data);
+      if (cmesh4::HashFileContents(path.c_str()) == hash)
+      {
+        printf("size %zu: byte %zu does not change the hash\n", size, i);
+        failures++;
+      }
+      data[i] ^= 0x5a;
+    }
+  }
+  remove(path.c_str());
+  printf("%s\n", failures == 0 ? "hash_file_test passed" : "hash_file_test FAILED");
+  return failures == 0 ? 0 : 1;
+}
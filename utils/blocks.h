@@ -1,6 +1,19 @@
+#pragma once
 #include <vector>
 #include <string>
 #include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+#include "LiteMath.h"
+#include "mapped_file.h"
+#include "public_image.h"
+
+using LiteMath::float2;
+using LiteMath::float3;
 
 
 int TEXTURE_SIZE = 16;
@@ -28,6 +41,15 @@ int texture_mask[8][6] = {  // +x -x +z -z +y -y
     {0, 0, 0, 0, 0, 0}
 };
 
+float3 face_normal[6] = {  // same face order as texture_mask
+    float3(1, 0, 0),
+    float3(-1, 0, 0),
+    float3(0, 0, 1),
+    float3(0, 0, -1),
+    float3(0, 1, 0),
+    float3(0, -1, 0)
+};
+
 std::vector <std::string> path_to_texture = {
     "textures/dirt/", 
     "textures/grass/", 
@@ -40,44 +62,275 @@ std::vector <std::string> path_to_texture = {
 };
 
 
-struct VoxelTexture {
-    std::vector<float> textures[6]; // +x -x +z -z +y -y
-    int id;
+const int BLOCK_TYPES = 8; // block ids 1..BLOCK_TYPES have textures, rows below are indexed by id - 1
 
-    void generate_texture(int id1) {
-        id = id1;
-        for (int i = 0; i < 6; ++i) {
-            std::string path = path_to_texture[id1] + std::to_string(texture_mask[id1][i]);
-            path += ".png";
-            read_image_rgb(path, textures[i], TEXTURE_SIZE, TEXTURE_SIZE);
+// All block face textures packed into one contiguous RGBA8 buffer.
+// Every distinct image is stored once as a tile of 0xAARRGGBB texels holding its full mip chain
+// (TEXTURE_SIZE^2, then (TEXTURE_SIZE/2)^2, ... down to 1x1), tiles start on a cache line,
+// and face_tile maps (block, face) to a tile.
+struct TextureAtlas {
+    static constexpr size_t ALIGNMENT = 64;
+    static constexpr int MAX_MIP_LEVELS = 16;
+
+    const uint32_t *texels = nullptr;   // either storage or a view into the mapped pack
+    uint32_t *storage = nullptr;
+    MappedFile pack;
+    int tile_count = 0;
+    int tile_size = 0;
+    int tile_stride = 0;                // texels per tile including mips, multiple of a cache line
+    int mip_levels = 0;
+    int mip_offset[MAX_MIP_LEVELS];     // start of each level inside a tile
+    uint16_t face_tile[BLOCK_TYPES][6]; // +x -x +z -z +y -y
+
+    TextureAtlas() = default;
+    TextureAtlas(const TextureAtlas &) = delete;
+    TextureAtlas &operator=(const TextureAtlas &) = delete;
+    ~TextureAtlas() { release(); }
+
+    void release() {
+        if (storage) {
+            ::operator delete[](storage, std::align_val_t(ALIGNMENT));
+            storage = nullptr;
         }
+        pack.close();
+        texels = nullptr;
     }
-    float3 get_color(float3 local_coord, float3 normal) {
-        local_coord = LiteMath::abs(local_coord);
-        int texture_x, texture_y;
-        int ind = -1;
-        if (normal.x != 0) {
-            texture_y = floor(local_coord.y * TEXTURE_SIZE);
-            texture_x = floor(local_coord.z * TEXTURE_SIZE);
-            
-            ind = normal.x > 0 ? 0 : 1;
-        } else if (normal.y != 0) {
-            texture_y = floor(local_coord.x * TEXTURE_SIZE);
-            texture_x = floor(local_coord.z * TEXTURE_SIZE);
-            ind = normal.y > 0 ? 4 : 5;
-        } else {
-            texture_x = floor(local_coord.x * TEXTURE_SIZE);
-            texture_y = floor(local_coord.y * TEXTURE_SIZE);
-            ind = normal.z > 0 ? 2 : 3;
+
+    void set_layout(int tiles, int size) {
+        tile_count = tiles;
+        tile_size = size;
+        mip_levels = 0;
+        int offset = 0;
+        for (int s = size; s >= 1; s /= 2) {
+            mip_offset[mip_levels++] = offset;
+            offset += s * s;
+        }
+        const int texels_per_line = ALIGNMENT / sizeof(uint32_t);
+        tile_stride = (offset + texels_per_line - 1) / texels_per_line * texels_per_line;
+    }
+
+    // size must be a power of two
+    void allocate(int tiles, int size) {
+        release();
+        set_layout(tiles, size);
+        storage = static_cast<uint32_t *>(::operator new[](sizeof(uint32_t) * tile_stride * tiles, std::align_val_t(ALIGNMENT)));
+        texels = storage;
+    }
+
+    const uint32_t *tile(int block_id, int face) const {
+        return texels + (size_t)face_tile[block_id - 1][face] * tile_stride;
+    }
+
+    size_t size_in_bytes() const { return sizeof(uint32_t) * tile_stride * tile_count + sizeof(face_tile); }
+
+    // Box-filters level 0 of every tile down to 1x1.
+    void generate_mips() {
+        for (int t = 0; t < tile_count; ++t) {
+            uint32_t *base = storage + (size_t)t * tile_stride;
+            for (int level = 1; level < mip_levels; ++level) {
+                const uint32_t *src = base + mip_offset[level - 1];
+                uint32_t *dst = base + mip_offset[level];
+                int src_size = tile_size >> (level - 1);
+                int dst_size = tile_size >> level;
+                for (int y = 0; y < dst_size; ++y) {
+                    for (int x = 0; x < dst_size; ++x) {
+                        uint32_t quad[4] = {
+                            src[(2 * y) * src_size + 2 * x], src[(2 * y) * src_size + 2 * x + 1],
+                            src[(2 * y + 1) * src_size + 2 * x], src[(2 * y + 1) * src_size + 2 * x + 1]
+                        };
+                        uint32_t result = 0;
+                        for (int shift = 0; shift < 32; shift += 8) {
+                            uint32_t sum = 2;
+                            for (int i = 0; i < 4; ++i) {
+                                sum += (quad[i] >> shift) & 0xFF;
+                            }
+                            result |= (sum / 4) << shift;
+                        }
+                        dst[y * dst_size + x] = result;
+                    }
+                }
+            }
+        }
+    }
+
+    // Fills face_tile and returns the distinct image files in tile order.
+    std::vector<std::string> collect_sources() {
+        std::vector<std::string> paths;
+        for (int b = 0; b < BLOCK_TYPES; ++b) {
+            for (int f = 0; f < 6; ++f) {
+                std::string path = path_to_texture[b] + std::to_string(texture_mask[b][f]) + ".png";
+                int found = std::find(paths.begin(), paths.end(), path) - paths.begin();
+                if (found == (int)paths.size()) {
+                    paths.push_back(path);
+                }
+                face_tile[b][f] = found;
+            }
+        }
+        return paths;
+    }
+
+    // Loads textures/<block>/<n>.png for every face, decoding each distinct file once. Faces whose
+    // file fails to load are magenta and make it return false.
+    bool build() {
+        bool ok = true;
+        std::vector<std::string> paths = collect_sources();
+        allocate(paths.size(), TEXTURE_SIZE);
+        std::vector<uint32_t> image;
+        for (int t = 0; t < tile_count; ++t) {
+            uint32_t *dst = storage + (size_t)t * tile_stride;
+            int w, h;
+            if (!read_image_rgba8(paths[t], image, w, h) || w != tile_size || h != tile_size) {
+                printf("[TextureAtlas::ERROR] Failed to load %dx%d texture: %s\n", tile_size, tile_size, paths[t].c_str());
+                std::fill(dst, dst + tile_size * tile_size, 0xFFFF00FF);
+                ok = false;
+                continue;
+            }
+            std::copy(image.begin(), image.end(), dst);
+        }
+        generate_mips();
+        return ok;
+    }
+
+    // Precompiled texture pack: a header followed by the texels exactly as they are laid out in memory,
+    // so loading is a single mmap. sources_hash identifies the set of source files and the tile size.
+    struct PackHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t tile_count;
+        uint32_t tile_size;
+        uint32_t tile_stride;
+        uint64_t sources_hash;
+        uint16_t face_tile[BLOCK_TYPES][6];
+    };
+    static constexpr uint32_t PACK_VERSION = 1;
+    static constexpr size_t PACK_DATA_OFFSET = 256; // texels start on a cache line of the mapping
+
+    static uint64_t hash_sources(const std::vector<std::string> &paths) {
+        uint64_t h = 14695981039346656037ull; // FNV-1a
+        auto mix = [&h](const void *data, size_t len) {
+            for (size_t i = 0; i < len; ++i) {
+                h = (h ^ static_cast<const uint8_t *>(data)[i]) * 1099511628211ull;
+            }
+        };
+        for (const std::string &p : paths) {
+            mix(p.c_str(), p.size() + 1);
+        }
+        mix(&TEXTURE_SIZE, sizeof(TEXTURE_SIZE));
+        return h;
+    }
+
+    bool save_pack(const char *path, uint64_t sources_hash) const {
+        static_assert(sizeof(PackHeader) <= PACK_DATA_OFFSET, "texture pack header does not fit");
+        FILE *out = fopen(path, "wb");
+        if (!out) {
+            printf("[TextureAtlas::ERROR] Failed to create texture pack: %s\n", path);
+            return false;
         }
-        
-        texture_x %= TEXTURE_SIZE;
-        texture_y %= TEXTURE_SIZE;
-        texture_y = TEXTURE_SIZE - texture_y - 1;
-        return float3(
-            textures[ind][(texture_y * TEXTURE_SIZE + texture_x) * 3], 
-            textures[ind][(texture_y * TEXTURE_SIZE + texture_x) * 3 + 1], 
-            textures[ind][(texture_y * TEXTURE_SIZE + texture_x) * 3 + 2]
-        );
-    }
-};
\ No newline at end of file
+        uint8_t header_bytes[PACK_DATA_OFFSET] = {};
+        PackHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "VXATLAS", 8);
+        header.version = PACK_VERSION;
+        header.tile_count = tile_count;
+        header.tile_size = tile_size;
+        header.tile_stride = tile_stride;
+        header.sources_hash = sources_hash;
+        memcpy(header.face_tile, face_tile, sizeof(face_tile));
+        memcpy(header_bytes, &header, sizeof(header));
+        bool ok = fwrite(header_bytes, 1, PACK_DATA_OFFSET, out) == PACK_DATA_OFFSET &&
+                  fwrite(texels, sizeof(uint32_t), (size_t)tile_stride * tile_count, out) == (size_t)tile_stride * tile_count;
+        fclose(out);
+        if (!ok) {
+            printf("[TextureAtlas::ERROR] Failed to write texture pack: %s\n", path);
+            remove(path);
+        }
+        return ok;
+    }
+
+    bool load_pack(const char *path, uint64_t sources_hash) {
+        release();
+        if (!pack.open(path) || pack.size < PACK_DATA_OFFSET) {
+            pack.close();
+            return false;
+        }
+        PackHeader header;
+        memcpy(&header, pack.data, sizeof(header));
+        set_layout(header.tile_count, header.tile_size);
+        if (memcmp(header.magic, "VXATLAS", 8) != 0 || header.version != PACK_VERSION ||
+            header.sources_hash != sources_hash || header.tile_stride != (uint32_t)tile_stride ||
+            pack.size != PACK_DATA_OFFSET + sizeof(uint32_t) * (size_t)tile_stride * tile_count) {
+            pack.close();
+            return false;
+        }
+        memcpy(face_tile, header.face_tile, sizeof(face_tile));
+        texels = reinterpret_cast<const uint32_t *>(pack.data + PACK_DATA_OFFSET);
+        return true;
+    }
+
+    // Maps the texture pack if it is up to date, otherwise decodes the PNGs and rewrites the pack.
+    // A missing source counts as newer than the pack, and a pack is only written when every source
+    // decoded, so a placeholder texture never gets cached.
+    void load(const char *pack_path = "textures/pack.bin") {
+        std::vector<std::string> paths = collect_sources();
+        uint64_t sources_hash = hash_sources(paths);
+
+        int64_t pack_time = file_mtime(pack_path);
+        bool fresh = pack_time >= 0;
+        for (const std::string &p : paths) {
+            int64_t source_time = file_mtime(p.c_str());
+            fresh = fresh && source_time >= 0 && source_time <= pack_time;
+        }
+        if (fresh && load_pack(pack_path, sources_hash)) {
+            return;
+        }
+        if (build()) {
+            save_pack(pack_path, sources_hash);
+        }
+    }
+
+    static int face_index(float3 normal) {
+        if (normal.x != 0) return normal.x > 0 ? 0 : 1;
+        if (normal.y != 0) return normal.y > 0 ? 4 : 5;
+        return normal.z > 0 ? 2 : 3;
+    }
+
+    // Mip level for a hit at distance dist: a pixel covers dist * pixel_spread world units across the
+    // ray, stretched by 1 / cos_theta along a slanted face, and one world unit holds tile_size texels.
+    float lod(float dist, float pixel_spread, float cos_theta) const {
+        float footprint = dist * pixel_spread / std::max(std::abs(cos_theta), 0.2f) * tile_size;
+        return footprint > 1.0f ? std::log2(footprint) : 0.0f;
+    }
+
+    // Texture coordinates of a point on a face, in voxel units (the fractional part selects the texel)
+    static float2 face_uv(float3 local_coord, int face) {
+        local_coord = LiteMath::abs(local_coord);
+        if (face < 2) return float2(local_coord.z, local_coord.y);
+        if (face < 4) return float2(local_coord.x, local_coord.y);
+        return float2(local_coord.z, local_coord.x);
+    }
+
+    uint32_t sample_uv(int block_id, int face, float2 uv, float lod = 0.0f) const {
+        int level = std::min(int(lod), mip_levels - 1);
+        int size = tile_size >> level;
+
+        int texture_x = int(floor(uv.x * size)) % size;
+        int texture_y = int(floor(uv.y * size)) % size;
+        texture_y = size - texture_y - 1;
+        return tile(block_id, face)[mip_offset[level] + texture_y * size + texture_x];
+    }
+
+    uint32_t sample(int block_id, float3 local_coord, float3 normal, float lod = 0.0f) const {
+        int face = face_index(normal);
+        return sample_uv(block_id, face, face_uv(local_coord, face), lod);
+    }
+
+    float3 get_color(int block_id, float3 local_coord, float3 normal, float lod = 0.0f) const {
+        uint32_t c = sample(block_id, local_coord, normal, lod);
+        return float3((c >> 16) & 0xFF, (c >> 8) & 0xFF, c & 0xFF) * (1.0f / 255.0f);
+    }
+
+    float3 get_color(int block_id, int face, float2 uv, float lod = 0.0f) const {
+        uint32_t c = sample_uv(block_id, face, uv, lod);
+        return float3((c >> 16) & 0xFF, (c >> 8) & 0xFF, c & 0xFF) * (1.0f / 255.0f);
+    }
+};
@@ -0,0 +1,296 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "LiteMath.h"
+#include "blocks.h"
+#include "mesh.h"
+#include "voxel_ao.h"
+#include "voxel_octree.h"
+
+using LiteMath::float2;
+using LiteMath::float3;
+using LiteMath::float4;
+using LiteMath::int3;
+
+// Surface extraction of octree chunks with greedy face merging, driven by the octree's leaves.
+// Every face of a non-empty leaf is tested against the node of the same size in front of it: an
+// empty (or missing) node leaves the whole face visible, a solid leaf hides it, and a subdivided one
+// is descended only along its children touching the face, so a uniform 32^3 block costs 6 tests
+// however many voxels it has. Faces on the chunk border are tested the same way against the
+// neighbouring chunk's octree (a missing chunk is empty). The visible rectangles are collected per
+// face plane and merged greedily into maximal rectangles of one block id over the bounding box of
+// that plane's faces only. Each rectangle becomes a quad: 4 vertices with normal, tangent and UVs in
+// voxel units, 2 triangles with matIndices set to the block id.
+
+// Block at voxel p of a chunk of the given size, EMPTY outside it
+int octree_block_at(const SparseOctree &tree, int size, int3 p) {
+    return octree_block_at(tree.nodes.data(), tree.far.data(), size, p);
+}
+
+// Visible part of a face, in the plane's (u, v) voxel coordinates
+struct FaceRect {
+    int u, v, w, h;
+    int id;
+};
+
+struct ChunkMesher {
+    std::vector<int3> chunk_pos;
+    const std::vector<SparseOctree> &chunks;
+    std::unordered_map<uint64_t, int> chunk_by_pos;
+
+    static uint64_t key(int3 p) {
+        return (uint64_t(uint32_t(p.x / CHUNK_SIZE) & 0x1fffff) << 42) | (uint64_t(uint32_t(p.y / CHUNK_SIZE) & 0x1fffff) << 21)
+            | uint64_t(uint32_t(p.z / CHUNK_SIZE) & 0x1fffff);
+    }
+
+    ChunkMesher(const std::vector<int3> &chunk_pos, const std::vector<SparseOctree> &chunks) : chunk_pos(chunk_pos), chunks(chunks) {
+        for (int i = 0; i < (int)chunk_pos.size(); ++i) {
+            chunk_by_pos[key(chunk_pos[i])] = i;
+        }
+    }
+
+    static int chunk_coord(int v) { return v >= 0 ? v / CHUNK_SIZE : -((-v + CHUNK_SIZE - 1) / CHUNK_SIZE); }
+
+    // Block at a world voxel, EMPTY where there is no chunk
+    int world_block(int3 world) const {
+        int3 c = int3(chunk_coord(world.x), chunk_coord(world.y), chunk_coord(world.z));
+        auto it = chunk_by_pos.find(key(c * CHUNK_SIZE));
+        if (it == chunk_by_pos.end()) {
+            return EMPTY;
+        }
+        return octree_block_at(chunks[it->second], CHUNK_SIZE, world - c * CHUNK_SIZE);
+    }
+
+    // Per thread scratch: visible face rectangles per plane ((axis * 2 + side) * CHUNK_SIZE + k) and
+    // the merge mask
+    struct Scratch {
+        std::vector<std::vector<FaceRect>> planes;
+        std::vector<int> mask;
+    };
+
+    // Node of tree covering the aligned cube of side size at pos; ind is -1 if the cube lies in a missing
+    // octant, and a leaf bigger than the cube is returned as is (it covers the cube uniformly)
+    static int find_node(const SparseOctree &tree, int3 pos, int size) {
+        int ind = 0, cur_size = CHUNK_SIZE;
+        int3 v = pos;
+        while (cur_size > size) {
+            unsigned int node = tree.nodes[ind];
+            if ((node & CHILD_MASK) == 0 && !(node & FAR_MASK)) {
+                return ind;
+            }
+            cur_size /= 2;
+            int i = ((v.x >= cur_size) << 2) | ((v.y >= cur_size) << 1) | (v.z >= cur_size);
+            v = v - node_offset[i] * cur_size;
+            if (!(node & ((1 << 15) >> i))) {
+                return -1;
+            }
+            int first = node & FAR_MASK ? ind + tree.far[(node & CHILD_MASK) >> 17] : ind + ((node & CHILD_MASK) >> 17);
+            // valid bits of the children before i
+            ind = first + (i == 0 ? 0 : __builtin_popcount((node >> (16 - i)) & ((1u << i) - 1)));
+        }
+        return ind;
+    }
+
+    // Adds the parts of a face of block id through which the cube (cur_pos, cur_size) in front of it is
+    // empty; near is the cube's side facing the face (0 low, 1 high along axis)
+    static void visible_parts(const SparseOctree &tree, int ind, int cur_size, int3 cur_pos, int axis, int near, int id,
+                              std::vector<FaceRect> &out) {
+        int ua = (axis + 1) % 3, va = (axis + 2) % 3;
+        unsigned int node = ind < 0 ? (unsigned int)EMPTY : tree.nodes[ind];
+        if (ind < 0 || ((node & CHILD_MASK) == 0 && !(node & FAR_MASK))) {
+            if (node == EMPTY) {
+                out.push_back(FaceRect{cur_pos[ua], cur_pos[va], cur_size, cur_size, id});
+            }
+            return;
+        }
+        int half = cur_size / 2;
+        int first = node & FAR_MASK ? ind + tree.far[(node & CHILD_MASK) >> 17] : ind + ((node & CHILD_MASK) >> 17);
+        int k = 0;
+        for (int i = 0; i < 8; ++i) {
+            bool present = node & ((1 << 15) >> i);
+            if (node_offset[i][axis] == near) {
+                visible_parts(tree, present ? first + k : -1, half, cur_pos + node_offset[i] * half, axis, near, id, out);
+            }
+            k += present;
+        }
+    }
+
+    // Visible faces of chunk c sorted into planes
+    void collect_faces(int c, Scratch &scratch) const {
+        const int N = CHUNK_SIZE;
+        const SparseOctree &tree = chunks[c];
+        scratch.planes.resize(6 * N);
+        for (std::vector<FaceRect> &plane : scratch.planes) {
+            plane.clear();
+        }
+        std::vector<OctreeLeaf> leaves;
+        collect_octree_leaves(tree.nodes.data(), tree.far.data(), 0, N, int3(0, 0, 0), leaves);
+        for (const OctreeLeaf &leaf : leaves) {
+            int id = tree.nodes[leaf.ind];
+            int s = leaf.size;
+            for (int axis = 0; axis < 3; ++axis) {
+                int ua = (axis + 1) % 3, va = (axis + 2) % 3;
+                for (int side = 0; side < 2; ++side) {
+                    int k = side == 0 ? leaf.pos[axis] + s - 1 : leaf.pos[axis];
+                    std::vector<FaceRect> &plane = scratch.planes[(axis * 2 + side) * N + k];
+                    int3 front = leaf.pos;
+                    front[axis] += side == 0 ? s : -s;
+                    const SparseOctree *front_tree = &tree;
+                    if (front[axis] < 0 || front[axis] >= N) {
+                        // the cube in front lies in the neighbouring chunk, at the same (u, v)
+                        int3 neighbour = chunk_pos[c];
+                        neighbour[axis] += side == 0 ? N : -N;
+                        auto it = chunk_by_pos.find(key(neighbour));
+                        front[axis] -= side == 0 ? N : -N;
+                        if (it == chunk_by_pos.end()) {
+                            plane.push_back(FaceRect{leaf.pos[ua], leaf.pos[va], s, s, id});
+                            continue;
+                        }
+                        front_tree = &chunks[it->second];
+                    }
+                    visible_parts(*front_tree, find_node(*front_tree, front, s), s, front, axis, side == 0 ? 0 : 1, id, plane);
+                }
+            }
+        }
+    }
+
+    // Greedy quads of one chunk appended to mesh
+    void mesh_chunk(int c, Scratch &scratch, cmesh4::SimpleMesh &mesh) const {
+        const int N = CHUNK_SIZE;
+        collect_faces(c, scratch);
+        std::vector<int> &mask = scratch.mask;
+        float3 origin = float3(chunk_pos[c]);
+
+        for (int axis = 0; axis < 3; ++axis) {
+            for (int side = 0; side < 2; ++side) {
+                for (int k = 0; k < N; ++k) {
+                    const std::vector<FaceRect> &plane = scratch.planes[(axis * 2 + side) * N + k];
+                    if (plane.empty()) {
+                        continue;
+                    }
+                    // visible faces of the slice, over the bounding box of its rectangles
+                    int u0 = N, v0 = N, u1 = 0, v1 = 0;
+                    for (const FaceRect &r : plane) {
+                        u0 = std::min(u0, r.u);
+                        v0 = std::min(v0, r.v);
+                        u1 = std::max(u1, r.u + r.w);
+                        v1 = std::max(v1, r.v + r.h);
+                    }
+                    const int W = u1 - u0, H = v1 - v0;
+                    mask.assign(W * H, EMPTY);
+                    for (const FaceRect &r : plane) {
+                        for (int u = r.u - u0; u < r.u - u0 + r.w; ++u) {
+                            std::fill(mask.begin() + u * H + r.v - v0, mask.begin() + u * H + r.v - v0 + r.h, r.id);
+                        }
+                    }
+
+                    // maximal rectangles of equal ids
+                    for (int u = 0; u < W; ++u) {
+                        for (int v = 0; v < H;) {
+                            int id = mask[u * H + v];
+                            if (id == EMPTY) {
+                                v++;
+                                continue;
+                            }
+                            int h = 1;
+                            while (v + h < H && mask[u * H + v + h] == id) {
+                                h++;
+                            }
+                            int w = 1;
+                            bool grow = true;
+                            while (u + w < W && grow) {
+                                for (int j = 0; j < h; ++j) {
+                                    if (mask[(u + w) * H + v + j] != id) {
+                                        grow = false;
+                                        break;
+                                    }
+                                }
+                                if (grow) {
+                                    w++;
+                                }
+                            }
+                            for (int i = 0; i < w; ++i) {
+                                std::fill(mask.begin() + (u + i) * H + v, mask.begin() + (u + i) * H + v + h, EMPTY);
+                            }
+                            emit_quad(mesh, origin, axis, side, k, u0 + u, v0 + v, w, h, id);
+                            v += h;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    static void emit_quad(cmesh4::SimpleMesh &mesh, float3 origin, int axis, int side, int k, int u, int v, int w, int h, int id) {
+        int ua = (axis + 1) % 3, va = (axis + 2) % 3;
+        float3 n = float3(0.0f), du = float3(0.0f), dv = float3(0.0f), base;
+        n[axis] = side == 0 ? 1.0f : -1.0f;
+        du[ua] = (float)w;
+        dv[va] = (float)h;
+        base[axis] = float(side == 0 ? k + 1 : k);
+        base[ua] = (float)u;
+        base[va] = (float)v;
+        base += origin;
+
+        unsigned int first = (unsigned int)mesh.vPos4f.size();
+        float3 corners[4] = {base, base + du, base + du + dv, base + dv};
+        float2 uvs[4] = {float2(0, 0), float2((float)w, 0), float2((float)w, (float)h), float2(0, (float)h)};
+        for (int i = 0; i < 4; ++i) {
+            mesh.vPos4f.push_back(float4(corners[i].x, corners[i].y, corners[i].z, 1.0f));
+            mesh.vNorm4f.push_back(float4(n.x, n.y, n.z, 0.0f));
+            mesh.vTang4f.push_back(float4(du.x / w, du.y / w, du.z / w, 0.0f));
+            mesh.vTexCoord2f.push_back(uvs[i]);
+        }
+        // du x dv points along +axis, so positive faces keep the corner order
+        static const int order[2][6] = {{0, 1, 2, 0, 2, 3}, {0, 2, 1, 0, 3, 2}};
+        for (int i = 0; i < 6; ++i) {
+            mesh.indices.push_back(first + order[side][i]);
+        }
+        mesh.matIndices.push_back(id);
+        mesh.matIndices.push_back(id);
+    }
+
+    cmesh4::SimpleMesh run() const {
+        int count = (int)chunk_pos.size();
+        std::vector<cmesh4::SimpleMesh> parts(count);
+        #pragma omp parallel
+        {
+            Scratch scratch;
+            #pragma omp for schedule(dynamic)
+            for (int c = 0; c < count; ++c) {
+                mesh_chunk(c, scratch, parts[c]);
+            }
+        }
+
+        // concatenate with rebased indices
+        std::vector<size_t> vert_start(count + 1, 0), ind_start(count + 1, 0);
+        for (int c = 0; c < count; ++c) {
+            vert_start[c + 1] = vert_start[c] + parts[c].VerticesNum();
+            ind_start[c + 1] = ind_start[c] + parts[c].IndicesNum();
+        }
+        cmesh4::SimpleMesh mesh(vert_start[count], ind_start[count]);
+        #pragma omp parallel for schedule(dynamic)
+        for (int c = 0; c < count; ++c) {
+            const cmesh4::SimpleMesh &part = parts[c];
+            std::copy(part.vPos4f.begin(), part.vPos4f.end(), mesh.vPos4f.begin() + vert_start[c]);
+            std::copy(part.vNorm4f.begin(), part.vNorm4f.end(), mesh.vNorm4f.begin() + vert_start[c]);
+            std::copy(part.vTang4f.begin(), part.vTang4f.end(), mesh.vTang4f.begin() + vert_start[c]);
+            std::copy(part.vTexCoord2f.begin(), part.vTexCoord2f.end(), mesh.vTexCoord2f.begin() + vert_start[c]);
+            for (size_t i = 0; i < part.indices.size(); ++i) {
+                mesh.indices[ind_start[c] + i] = part.indices[i] + (unsigned int)vert_start[c];
+            }
+            std::copy(part.matIndices.begin(), part.matIndices.end(), mesh.matIndices.begin() + ind_start[c] / 3);
+        }
+        return mesh;
+    }
+};
+
+// Triangle mesh of the visible surface of a set of chunks (chunk_pos[i] is the minimum voxel of
+// chunks[i]); export it with cmesh4::SaveMeshToObj.
+cmesh4::SimpleMesh mesh_chunks(const std::vector<int3> &chunk_pos, const std::vector<SparseOctree> &chunks) {
+    ChunkMesher mesher(chunk_pos, chunks);
+    return mesher.run();
+}
@@ -0,0 +1,216 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "LiteMath.h"
+#include "blocks.h"
+#include "voxel_octree.h"
+
+using LiteMath::float3;
+using LiteMath::int3;
+
+// Voxel cone traced ambient light.
+// Every octree node gets a prefiltered value, packed as R8 G8 B8 and occupancy in the top byte, in an
+// array parallel to the nodes: leaves hold the average texture colour of their block (occupancy 255
+// unless empty), interior nodes the occupancy weighted mean of their 8 octants (missing octants are
+// empty). A cone then marches along its axis sampling the node whose size matches the cone diameter
+// at that distance, so wider parts of the cone read coarser levels, and composites the samples front
+// to back. A few cones around the normal give the sky visibility (ambient) and the colour of nearby
+// occluders (one soft bounce) in a few dozen fetches per pixel.
+
+const int CONE_COUNT = 5;
+
+struct ConeTracer {
+    const unsigned int *nodes = nullptr;
+    const unsigned int *far = nullptr;
+    std::vector<uint32_t> filtered;
+    int size = 0;
+    int3 origin = int3(0, 0, 0);
+    float block_colour[BLOCK_TYPES + 1][3] = {};
+
+    bool enabled = false;
+    float max_dist = 24.0f;         // voxels
+    float aperture = 0.577f;        // tan of the half angle, 60 degree cones
+    float bounce = 0.6f;            // strength of the light reflected by occluders
+
+    static uint32_t pack(float r, float g, float b, float occupancy) {
+        auto q = [](float v) { return (uint32_t)std::min(255.0f, v * 255.0f + 0.5f); };
+        return (q(occupancy) << 24) | (q(r) << 16) | (q(g) << 8) | q(b);
+    }
+
+    uint32_t leaf_value(unsigned int node) const {
+        return node == 0 ? 0 : pack(block_colour[node][0], block_colour[node][1], block_colour[node][2], 1.0f);
+    }
+
+    static uint32_t combine(const uint32_t *values, int count) {
+        float r = 0.0f, g = 0.0f, b = 0.0f, occupancy = 0.0f;
+        for (int k = 0; k < count; ++k) {
+            float a = (values[k] >> 24) / 255.0f;
+            r += a * ((values[k] >> 16) & 0xFF);
+            g += a * ((values[k] >> 8) & 0xFF);
+            b += a * (values[k] & 0xFF);
+            occupancy += a;
+        }
+        float inv = occupancy > 0.0f ? 1.0f / (occupancy * 255.0f) : 0.0f;
+        return pack(r * inv, g * inv, b * inv, occupancy / 8.0f);
+    }
+
+    uint32_t prefilter(int ind, int depth) {
+        unsigned int node = nodes[ind];
+        if ((node & CHILD_MASK) == 0 && !(node & FAR_MASK)) {
+            filtered[ind] = leaf_value(node);
+            return filtered[ind];
+        }
+        int first = node & FAR_MASK ? ind + far[(node & CHILD_MASK) >> 17] : ind + ((node & CHILD_MASK) >> 17);
+        int child[8], count = 0;
+        for (int i = 0; i < 8; ++i) {
+            if (node & ((1 << 15) >> i)) {
+                child[count] = first + count;
+                count++;
+            }
+        }
+        uint32_t values[8];
+        if (depth == 0) {
+            // the root's octants are independent
+            #pragma omp parallel for
+            for (int k = 0; k < count; ++k) {
+                values[k] = prefilter(child[k], depth + 1);
+            }
+        } else {
+            for (int k = 0; k < count; ++k) {
+                values[k] = prefilter(child[k], depth + 1);
+            }
+        }
+        filtered[ind] = combine(values, count);
+        return filtered[ind];
+    }
+
+    // Prefilters an encoded octree of the given size with minimum corner at world position origin;
+    // the octree must stay alive while the tracer is used
+    void build(const unsigned int *tree_nodes, const unsigned int *tree_far, int len, int tree_size, int3 tree_origin,
+               const TextureAtlas &atlas) {
+        size = tree_size;
+        origin = tree_origin;
+        for (int id = 1; id <= BLOCK_TYPES; ++id) {
+            // the last mip level is the 1x1 average of a face
+            float3 sum = float3(0.0f);
+            for (int f = 0; f < 6; ++f) {
+                uint32_t c = atlas.tile(id, f)[atlas.mip_offset[atlas.mip_levels - 1]];
+                sum += float3((c >> 16) & 0xFF, (c >> 8) & 0xFF, c & 0xFF) * (1.0f / 255.0f);
+            }
+            block_colour[id][0] = sum.x / 6.0f;
+            block_colour[id][1] = sum.y / 6.0f;
+            block_colour[id][2] = sum.z / 6.0f;
+        }
+        refilter(tree_nodes, tree_far, len);
+    }
+
+    // Prefilters the whole octree again, after its nodes were re-encoded
+    void refilter(const unsigned int *tree_nodes, const unsigned int *tree_far, int len) {
+        nodes = tree_nodes;
+        far = tree_far;
+        filtered.assign(len, 0);
+        prefilter(0, 0);
+    }
+
+    // Updates the values along path (root to leaf, from octree_set_block) after a voxel edit; the
+    // leaves split off on the way get their value here too
+    void update(const unsigned int *tree_nodes, const unsigned int *tree_far, int len, const std::vector<int> &path) {
+        nodes = tree_nodes;
+        far = tree_far;
+        filtered.resize(len, 0);
+        for (int p = (int)path.size() - 1; p >= 0; --p) {
+            int ind = path[p];
+            unsigned int node = nodes[ind];
+            if ((node & CHILD_MASK) == 0 && !(node & FAR_MASK)) {
+                filtered[ind] = leaf_value(node);
+                continue;
+            }
+            int first = node & FAR_MASK ? ind + far[(node & CHILD_MASK) >> 17] : ind + ((node & CHILD_MASK) >> 17);
+            uint32_t values[8];
+            int count = 0;
+            for (int i = 0; i < 8; ++i) {
+                if (node & ((1 << 15) >> i)) {
+                    unsigned int child = nodes[first + count];
+                    if ((child & CHILD_MASK) == 0 && !(child & FAR_MASK)) {
+                        filtered[first + count] = leaf_value(child);
+                    }
+                    values[count] = filtered[first + count];
+                    count++;
+                }
+            }
+            filtered[ind] = combine(values, count);
+        }
+    }
+
+    // Prefiltered value of the node containing p whose size is at most diameter (or of the leaf
+    // containing p if that is larger), 0 outside the octree
+    uint32_t sample(float3 p, float diameter) const {
+        float3 local = p - float3(origin);
+        if (local.x < 0 || local.y < 0 || local.z < 0 || local.x >= size || local.y >= size || local.z >= size) {
+            return 0;
+        }
+        int3 v = int3((int)local.x, (int)local.y, (int)local.z);
+        int ind = 0, cur_size = size;
+        while (true) {
+            unsigned int node = nodes[ind];
+            if (((node & CHILD_MASK) == 0 && !(node & FAR_MASK)) || cur_size <= diameter) {
+                return filtered[ind];
+            }
+            cur_size /= 2;
+            int i = ((v.x >= cur_size) << 2) | ((v.y >= cur_size) << 1) | (v.z >= cur_size);
+            v = v - node_offset[i] * cur_size;
+            if (!(node & ((1 << 15) >> i))) {
+                return 0;
+            }
+            int first = node & FAR_MASK ? ind + far[(node & CHILD_MASK) >> 17] : ind + ((node & CHILD_MASK) >> 17);
+            int skip = 0;
+            for (int j = 0; j < i; ++j) {
+                skip += (node >> (15 - j)) & 1;
+            }
+            ind = first + skip;
+        }
+    }
+
+    // Front to back occupancy and colour along one cone
+    void trace_cone(float3 p, float3 dir, float &occlusion, float3 &colour) const {
+        occlusion = 0.0f;
+        colour = float3(0.0f);
+        float t = 1.0f;
+        while (t < max_dist && occlusion < 0.95f) {
+            float diameter = std::max(1.0f, 2.0f * aperture * t);
+            uint32_t s = sample(p + dir * t, diameter);
+            float a = (s >> 24) / 255.0f;
+            float w = (1.0f - occlusion) * a;
+            colour += w * float3((s >> 16) & 0xFF, (s >> 8) & 0xFF, s & 0xFF) * (1.0f / 255.0f);
+            occlusion += w;
+            t += diameter * 0.5f;
+        }
+    }
+
+    // Sky visibility (0..1) and bounced light at a surface point p with normal n
+    void ambient(float3 p, float3 n, float &visibility, float3 &indirect) const {
+        float3 tangent = normalize(cross(n, std::abs(n.y) < 0.99f ? float3(0, 1, 0) : float3(1, 0, 0)));
+        float3 bitangent = cross(n, tangent);
+        // one cone along the normal and four tilted by 45 degrees, weighted by cosine
+        const float3 dirs[CONE_COUNT] = {
+            n, normalize(n + tangent), normalize(n - tangent), normalize(n + bitangent), normalize(n - bitangent)
+        };
+        const float weights[CONE_COUNT] = {1.0f, 0.7071f, 0.7071f, 0.7071f, 0.7071f};
+        const float total = 1.0f + 4.0f * 0.7071f;
+
+        visibility = 0.0f;
+        indirect = float3(0.0f);
+        for (int c = 0; c < CONE_COUNT; ++c) {
+            float occlusion;
+            float3 colour;
+            trace_cone(p, dirs[c], occlusion, colour);
+            visibility += weights[c] * (1.0f - occlusion);
+            indirect += weights[c] * colour;
+        }
+        visibility /= total;
+        indirect = indirect * (bounce / total);
+    }
+};
@@ -0,0 +1,94 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Dynamic resolution scaling.
+// Trace cost is roughly proportional to the number of pixels, so the controller moves the render
+// scale by sqrt(budget / measured) each frame, with smoothing and a dead band to avoid oscillation.
+struct ResolutionController {
+    float budget_ms = 16.6f;   // target render() time, <= 0 disables scaling
+    float min_scale = 0.4f;
+    float max_scale = 1.0f;
+    float scale = 1.0f;
+    float smoothed_ms = 0.0f;
+    float smoothing = 0.2f;    // weight of the newest measurement
+    float dead_band = 0.08f;   // relative error that is tolerated without a change
+    float max_step = 0.1f;     // max relative change of scale per frame
+
+    void update(float render_ms) {
+        if (budget_ms <= 0.0f) {
+            scale = max_scale;
+            return;
+        }
+        smoothed_ms = smoothed_ms == 0.0f ? render_ms : smoothed_ms + smoothing * (render_ms - smoothed_ms);
+        float ratio = budget_ms / std::max(smoothed_ms, 0.01f);
+        if (std::abs(ratio - 1.0f) < dead_band) {
+            return;
+        }
+        float step = std::clamp(std::sqrt(ratio), 1.0f - max_step, 1.0f + max_step);
+        scale = std::clamp(scale * step, min_scale, max_scale);
+    }
+
+    // Internal resolution for the given window, rounded down to a multiple of 4.
+    void render_size(int window_w, int window_h, int &w, int &h) const {
+        w = std::max(4, (int(window_w * scale) / 4) * 4);
+        h = std::max(4, (int(window_h * scale) / 4) * 4);
+        if (scale >= max_scale && max_scale >= 1.0f) {
+            w = window_w;
+            h = window_h;
+        }
+    }
+};
+
+inline float rgba8_luma(uint32_t c) {
+    return (((c >> 16) & 0xFF) * 0.299f + ((c >> 8) & 0xFF) * 0.587f + (c & 0xFF) * 0.114f) * (1.0f / 255.0f);
+}
+
+// Edge-aware upscale: bilinear footprint whose tap weights are scaled down by the luma difference to
+// the nearest source texel, so colours are not blended across edges while flat regions stay smooth.
+void upscale_edge_aware(const uint32_t *src, int src_w, int src_h, uint32_t *dst, int dst_w, int dst_h,
+    float edge_sharpness = 8.0f)
+{
+    if (src_w == dst_w && src_h == dst_h) {
+        std::copy(src, src + src_w * src_h, dst);
+        return;
+    }
+    float sx = float(src_w) / dst_w;
+    float sy = float(src_h) / dst_h;
+
+    #pragma omp parallel for
+    for (int y = 0; y < dst_h; y++)
+    {
+        float fy = std::max((y + 0.5f) * sy - 0.5f, 0.0f);
+        int y0 = std::min(int(fy), src_h - 1);
+        int y1 = std::min(y0 + 1, src_h - 1);
+        float wy = fy - y0;
+
+        for (int x = 0; x < dst_w; x++)
+        {
+            float fx = std::max((x + 0.5f) * sx - 0.5f, 0.0f);
+            int x0 = std::min(int(fx), src_w - 1);
+            int x1 = std::min(x0 + 1, src_w - 1);
+            float wx = fx - x0;
+
+            uint32_t taps[4] = {src[y0 * src_w + x0], src[y0 * src_w + x1], src[y1 * src_w + x0], src[y1 * src_w + x1]};
+            float w[4] = {(1 - wx) * (1 - wy), wx * (1 - wy), (1 - wx) * wy, wx * wy};
+
+            int nearest = (wx < 0.5f ? 0 : 1) + (wy < 0.5f ? 0 : 2);
+            float ref = rgba8_luma(taps[nearest]);
+            float r = 0, g = 0, b = 0, sum = 0;
+            for (int i = 0; i < 4; ++i) {
+                float d = std::abs(rgba8_luma(taps[i]) - ref);
+                float wi = w[i] / (1.0f + edge_sharpness * edge_sharpness * d * d * 16.0f);
+                r += ((taps[i] >> 16) & 0xFF) * wi;
+                g += ((taps[i] >> 8) & 0xFF) * wi;
+                b += (taps[i] & 0xFF) * wi;
+                sum += wi;
+            }
+            float inv = 1.0f / sum;
+            dst[y * dst_w + x] = 0xFF000000 | (uint32_t(r * inv + 0.5f) << 16) | (uint32_t(g * inv + 0.5f) << 8) | uint32_t(b * inv + 0.5f);
+        }
+    }
+}
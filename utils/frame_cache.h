@@ -0,0 +1,155 @@
+#pragma once
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "LiteMath.h"
+#include "public_camera.h"
+
+using LiteMath::float2;
+using LiteMath::float3;
+
+// Frame level change detection for a still camera.
+// The last rendered frame is kept at render resolution together with what it was rendered from: the
+// camera, the render size and the render settings. While none of them changed and nothing in the
+// world did, the frame stays on screen and nothing is traced. World changes are reported as world
+// space boxes (chunks whose version changed, old and new bounds of moved instances); the 8 corners of
+// each box are projected to the screen and only the pixels inside the resulting rectangles are traced
+// again. A box reaching behind the camera plane covers the whole screen, one entirely behind it none.
+
+struct ScreenRect {
+    int x0, y0, x1, y1;     // [x0, x1) x [y0, y1)
+};
+
+enum FrameUpdate {
+    FRAME_CACHED,           // the previous frame is still current
+    FRAME_PARTIAL,          // only the rectangles need to be traced again
+    FRAME_FULL
+};
+
+struct FrameCache {
+    int width = 0;
+    int height = 0;
+    float3 pos = float3(0.0f);
+    float3 dir = float3(0.0f);
+    int settings = -1;
+    bool valid = false;
+    int still_frames = 0;               // full frames rendered in a row from this view
+    std::vector<uint32_t> image;        // last frame, width * height
+    std::vector<uint32_t> versions;     // last seen version per tracked id
+    std::vector<float3> dirty_min, dirty_max;
+
+    void invalidate() { valid = false; }
+
+    void mark_dirty(float3 lo, float3 hi) {
+        dirty_min.push_back(lo);
+        dirty_max.push_back(hi);
+    }
+
+    // Marks the box dirty when the version of id changed since the last call (new ids count as changed)
+    void check_version(int id, uint32_t version, float3 lo, float3 hi) {
+        if (id >= (int)versions.size()) {
+            versions.resize(id + 1, UINT32_MAX);
+        }
+        if (versions[id] != version) {
+            versions[id] = version;
+            mark_dirty(lo, hi);
+        }
+    }
+
+    // Screen rectangle of a world box, project(p, xy) as world_to_screen; false if it covers no pixel
+    template <class Project>
+    bool project_box(float3 lo, float3 hi, Project project, ScreenRect &rect) const {
+        float2 smin = float2(1e30f), smax = float2(-1e30f);
+        int behind = 0;
+        for (int c = 0; c < 8; ++c) {
+            float2 xy;
+            if (!project(float3(c & 4 ? hi.x : lo.x, c & 2 ? hi.y : lo.y, c & 1 ? hi.z : lo.z), xy)) {
+                behind++;
+                continue;
+            }
+            smin = min(smin, xy);
+            smax = max(smax, xy);
+        }
+        if (behind == 8) {
+            return false;
+        }
+        if (behind > 0) {
+            rect = ScreenRect{0, 0, width, height};
+            return true;
+        }
+        // a pixel may see the box through any part of its footprint
+        rect.x0 = std::max(0, (int)std::floor(smin.x) - 1);
+        rect.y0 = std::max(0, (int)std::floor(smin.y) - 1);
+        rect.x1 = std::min(width, (int)std::ceil(smax.x) + 2);
+        rect.y1 = std::min(height, (int)std::ceil(smax.y) + 2);
+        return rect.x0 < rect.x1 && rect.y0 < rect.y1;
+    }
+
+    // Replaces overlapping rectangles by their bounding box until none overlap, so no pixel is traced twice
+    static void merge_rects(std::vector<ScreenRect> &rects) {
+        bool merged = true;
+        while (merged) {
+            merged = false;
+            for (size_t i = 0; i < rects.size() && !merged; ++i) {
+                for (size_t j = i + 1; j < rects.size(); ++j) {
+                    ScreenRect &a = rects[i];
+                    const ScreenRect &b = rects[j];
+                    if (a.x0 < b.x1 && b.x0 < a.x1 && a.y0 < b.y1 && b.y0 < a.y1) {
+                        a = ScreenRect{std::min(a.x0, b.x0), std::min(a.y0, b.y0), std::max(a.x1, b.x1), std::max(a.y1, b.y1)};
+                        rects.erase(rects.begin() + j);
+                        merged = true;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    // Decides how much of a frame of size w x h must be traced; rects receives the regions of a
+    // FRAME_PARTIAL update, which do not overlap. Dirty boxes are consumed.
+    template <class Project>
+    FrameUpdate begin(const Camera &camera, int w, int h, int render_settings, Project project, std::vector<ScreenRect> &rects) {
+        rects.clear();
+        bool same_view = w == width && h == height && render_settings == settings &&
+                         camera.pos.x == pos.x && camera.pos.y == pos.y && camera.pos.z == pos.z &&
+                         camera.dir.x == dir.x && camera.dir.y == dir.y && camera.dir.z == dir.z;
+        if (!same_view) {
+            width = w;
+            height = h;
+            settings = render_settings;
+            pos = camera.pos;
+            dir = camera.dir;
+            image.resize(w * h);
+            valid = false;
+            still_frames = 0;
+        }
+        FrameUpdate update = valid ? FRAME_CACHED : FRAME_FULL;
+        if (valid) {
+            for (size_t i = 0; i < dirty_min.size(); ++i) {
+                ScreenRect rect;
+                if (project_box(dirty_min[i], dirty_max[i], project, rect)) {
+                    rects.push_back(rect);
+                    update = FRAME_PARTIAL;
+                }
+            }
+        }
+        merge_rects(rects);
+        dirty_min.clear();
+        dirty_max.clear();
+        if (update == FRAME_FULL) {
+            still_frames++;
+        }
+        return update;
+    }
+
+    // Starts the still frame count over with the current frame, for images that cannot be patched
+    // and are traced in full instead
+    void restart() { still_frames = 1; }
+
+    // complete is false while the image still changes from frame to frame at a still view
+    // (accumulation, interleaved phases), which keeps every frame a full one
+    void end(bool complete) { valid = complete; }
+};
@@ -0,0 +1,110 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "LiteMath.h"
+#include "blocks.h"
+
+using LiteMath::float3;
+
+// Deferred shading.
+// The trace pass only writes what it found per pixel (block id, face, texture coordinates, mip level,
+// ambient shade and depth) into structure-of-arrays planes; shade_gbuffer_row() then turns a whole row into RGBA8
+// with straight-line code over contiguous arrays that the compiler vectorises.
+
+// Per-face directional lighting. Faces are axis aligned, so N.L only has six values per frame.
+struct FaceLighting {
+    float shade[6];        // +x -x +z -z +y -y
+    uint32_t shade_fx[6];  // shade in 8.8 fixed point for the integer shading path
+
+    void update(float3 light_dir, float ambient = 0.45f) {
+        light_dir = normalize(light_dir);
+        for (int f = 0; f < 6; ++f) {
+            shade[f] = std::min(1.0f, ambient + (1.0f - ambient) * std::max(0.0f, dot(face_normal[f], light_dir)));
+            shade_fx[f] = uint32_t(shade[f] * 256.0f + 0.5f);
+        }
+    }
+};
+
+struct GBuffer {
+    int width = 0;
+    int height = 0;
+    std::vector<uint8_t> block;   // 0 - nothing hit
+    std::vector<uint8_t> face;    // +x -x +z -z +y -y
+    std::vector<uint8_t> level;   // texture mip level
+    std::vector<uint8_t> u, v;    // position on the face in 1/256 of a voxel
+    std::vector<uint8_t> ambient; // baked AO times flood fill light, 255 - fully lit
+    std::vector<float> depth;
+
+    void resize(int w, int h) {
+        if (w == width && h == height) {
+            return;
+        }
+        width = w;
+        height = h;
+        block.assign(w * h, 0);
+        face.assign(w * h, 0);
+        level.assign(w * h, 0);
+        u.assign(w * h, 0);
+        v.assign(w * h, 0);
+        ambient.assign(w * h, 255);
+        depth.assign(w * h, 0.0f);
+    }
+};
+
+// background must be an 0xAARRGGBB colour
+void shade_gbuffer_row(const GBuffer &gbuffer, int y, const TextureAtlas &atlas, const FaceLighting &lighting,
+                       uint32_t background, uint32_t *out_row)
+{
+    const int W = gbuffer.width;
+    const uint8_t *block = gbuffer.block.data() + y * W;
+    const uint8_t *face = gbuffer.face.data() + y * W;
+    const uint8_t *level = gbuffer.level.data() + y * W;
+    const uint8_t *u = gbuffer.u.data() + y * W;
+    const uint8_t *v = gbuffer.v.data() + y * W;
+    const uint8_t *ambient = gbuffer.ambient.data() + y * W;
+    const uint32_t *texels = atlas.texels;
+    const int *mip_offset = atlas.mip_offset;
+    const uint32_t *shade_fx = lighting.shade_fx;
+    const int tile_size = atlas.tile_size;
+
+    // 32-bit (block, face) -> tile start table, row 0 stands in for empty pixels; gathers need 32-bit indices
+    int tile_start[(BLOCK_TYPES + 1) * 6] = {};
+    for (int b = 0; b < BLOCK_TYPES; ++b) {
+        for (int f = 0; f < 6; ++f) {
+            tile_start[(b + 1) * 6 + f] = atlas.face_tile[b][f] * atlas.tile_stride;
+        }
+    }
+
+    #pragma omp simd
+    for (int x = 0; x < W; x++)
+    {
+        int id = block[x];
+        int f = face[x];
+        int lv = level[x];
+        int size = tile_size >> lv;
+        int tx = (u[x] * size) >> 8;
+        int ty = size - 1 - ((v[x] * size) >> 8);
+        uint32_t c = texels[tile_start[id * 6 + f] + mip_offset[lv] + ty * size + tx];
+
+        uint32_t s = (shade_fx[f] * (ambient[x] + 1)) >> 8;
+        uint32_t r = (((c >> 16) & 0xFF) * s) >> 8;
+        uint32_t g = (((c >> 8) & 0xFF) * s) >> 8;
+        uint32_t b = ((c & 0xFF) * s) >> 8;
+        uint32_t shaded = 0xFF000000 | (std::min(r, 255u) << 16) | (std::min(g, 255u) << 8) | std::min(b, 255u);
+        out_row[x] = id != 0 ? shaded : background;
+    }
+}
+
+// Shades the rows y with rows[y] != 0, the other rows of out_image are left as they are
+void shade_gbuffer(const GBuffer &gbuffer, const TextureAtlas &atlas, const FaceLighting &lighting,
+                   uint32_t background, const std::vector<uint8_t> &rows, uint32_t *out_image)
+{
+    #pragma omp parallel for
+    for (int y = 0; y < gbuffer.height; y++)
+    {
+        if (rows[y])
+            shade_gbuffer_row(gbuffer, y, atlas, lighting, background, out_image + y * gbuffer.width);
+    }
+}
@@ -0,0 +1,222 @@
+#pragma once
+#include <algorithm>
+#include <cfloat>
+#include <vector>
+
+#include "LiteMath.h"
+
+using LiteMath::float2;
+using LiteMath::float3;
+using LiteMath::float4x4;
+
+// Top level BVH over instance bounds, shared by the mesh and voxel instance scenes.
+// Instances report their world bounds with set_bounds; update() rebuilds when the instance count
+// changed and otherwise refits the node boxes bottom-up, falling back to a rebuild once moving
+// instances have made the refitted tree much worse than a fresh one.
+
+struct InstanceHit {
+    float t;
+    float3 normal;      // world space, facing the ray
+    float2 uv;          // voxel units, fractional part selects the texel
+    int face;           // face_normal order (+x -x +z -z +y -y)
+    int block_id;
+    float ao;           // ambient occlusion shade factor, 1 when not baked
+};
+
+// Face of the dominant axis of n, in face_normal order
+inline int dominant_face(float3 n) {
+    float3 a = LiteMath::abs(n);
+    if (a.x >= a.y && a.x >= a.z) return n.x > 0.0f ? 0 : 1;
+    if (a.z >= a.y) return n.z > 0.0f ? 2 : 3;
+    return n.y > 0.0f ? 4 : 5;
+}
+
+// World bounds of the object space box [lo, hi] under transform
+inline void transform_bounds(const float4x4 &transform, float3 lo, float3 hi, float3 &out_lo, float3 &out_hi) {
+    out_lo = float3(FLT_MAX);
+    out_hi = float3(-FLT_MAX);
+    for (int c = 0; c < 8; ++c) {
+        float3 p = LiteMath::mul4x3(transform, float3(c & 4 ? hi.x : lo.x, c & 2 ? hi.y : lo.y, c & 1 ? hi.z : lo.z));
+        out_lo = min(out_lo, p);
+        out_hi = max(out_hi, p);
+    }
+}
+
+const int INSTANCE_LEAF_SIZE = 2;
+const float INSTANCE_REBUILD_RATIO = 2.0f;
+
+struct InstanceBVH {
+    struct Node {
+        float3 bmin, bmax;
+        int left = -1;          // right child is left + 1, -1 for leaves
+        int first = 0, count = 0;
+    };
+    std::vector<Node> nodes;
+    std::vector<int> order;     // instance ids, leaves cover [first, first + count)
+    std::vector<float3> box_min, box_max;
+    std::vector<float3> changed_min, changed_max;   // old and new bounds of moves, see take_changes
+    float built_cost = 0.0f;
+    bool dirty = false;
+
+    void set_bounds(int instance, float3 lo, float3 hi) {
+        if (instance >= (int)box_min.size()) {
+            box_min.resize(instance + 1);
+            box_max.resize(instance + 1);
+        } else {
+            changed_min.push_back(box_min[instance]);
+            changed_max.push_back(box_max[instance]);
+        }
+        changed_min.push_back(lo);
+        changed_max.push_back(hi);
+        box_min[instance] = lo;
+        box_max[instance] = hi;
+        dirty = true;
+    }
+
+    // Hands the boxes that changed since the last call to visit(lo, hi) and forgets them
+    template <class Visit>
+    void take_changes(Visit visit) {
+        for (size_t i = 0; i < changed_min.size(); ++i) {
+            visit(changed_min[i], changed_max[i]);
+        }
+        changed_min.clear();
+        changed_max.clear();
+    }
+
+    static float area(float3 lo, float3 hi) {
+        float3 d = max(hi - lo, float3(0.0f));
+        return d.x * d.y + d.y * d.z + d.z * d.x;
+    }
+
+    float cost() const {
+        float sum = 0.0f;
+        for (const Node &n : nodes) {
+            sum += area(n.bmin, n.bmax);
+        }
+        return sum;
+    }
+
+    void build_node(int ind, int first, int count) {
+        float3 cmin = float3(FLT_MAX), cmax = float3(-FLT_MAX);
+        for (int i = first; i < first + count; ++i) {
+            float3 c = (box_min[order[i]] + box_max[order[i]]) * 0.5f;
+            cmin = min(cmin, c);
+            cmax = max(cmax, c);
+        }
+        nodes[ind].first = first;
+        nodes[ind].count = count;
+        if (count <= INSTANCE_LEAF_SIZE) {
+            return;
+        }
+
+        // median split along the largest centroid extent
+        float3 extent = cmax - cmin;
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        int mid = first + count / 2;
+        std::nth_element(order.begin() + first, order.begin() + mid, order.begin() + first + count, [&](int a, int b) {
+            return box_min[a][axis] + box_max[a][axis] < box_min[b][axis] + box_max[b][axis];
+        });
+        int left = (int)nodes.size();
+        nodes.emplace_back();
+        nodes.emplace_back();
+        nodes[ind].left = left;
+        build_node(left, first, mid - first);
+        build_node(left + 1, mid, first + count - mid);
+    }
+
+    void build() {
+        int count = (int)box_min.size();
+        nodes.clear();
+        order.resize(count);
+        for (int i = 0; i < count; ++i) {
+            order[i] = i;
+        }
+        if (count > 0) {
+            nodes.emplace_back();
+            build_node(0, 0, count);
+        }
+        refit();
+        built_cost = cost();
+    }
+
+    // Children always follow their parent, so one reverse pass updates every box
+    void refit() {
+        for (int i = (int)nodes.size() - 1; i >= 0; --i) {
+            Node &n = nodes[i];
+            if (n.left >= 0) {
+                n.bmin = min(nodes[n.left].bmin, nodes[n.left + 1].bmin);
+                n.bmax = max(nodes[n.left].bmax, nodes[n.left + 1].bmax);
+                continue;
+            }
+            n.bmin = float3(FLT_MAX);
+            n.bmax = float3(-FLT_MAX);
+            for (int j = n.first; j < n.first + n.count; ++j) {
+                n.bmin = min(n.bmin, box_min[order[j]]);
+                n.bmax = max(n.bmax, box_max[order[j]]);
+            }
+        }
+    }
+
+    // Call once per frame before tracing
+    void update() {
+        if (order.size() != box_min.size()) {
+            build();
+        } else if (dirty) {
+            refit();
+            if (cost() > built_cost * INSTANCE_REBUILD_RATIO) {
+                build();
+            }
+        }
+        dirty = false;
+    }
+
+    // Calls visit(instance, t_max) for every instance whose box the ray enters before t_max, near
+    // nodes first; visit lowers t_max when it finds a closer hit.
+    template <class Visit>
+    void traverse(float3 ro, float3 rd, float &t_max, Visit visit) const {
+        if (nodes.empty()) {
+            return;
+        }
+        float3 inv = float3(1.0f) / rd;
+        auto enter = [&](const Node &n) {
+            float3 t0 = (n.bmin - ro) * inv, t1 = (n.bmax - ro) * inv;
+            float3 tn = min(t0, t1), tf = max(t0, t1);
+            float t_enter = std::max(std::max(tn.x, tn.y), std::max(tn.z, 0.0f));
+            float t_exit = std::min(std::min(tf.x, tf.y), std::min(tf.z, t_max));
+            return t_enter <= t_exit ? t_enter : FLT_MAX;
+        };
+
+        struct Entry { int node; float t; };
+        Entry stack[64];
+        int sp = 0;
+        float t_root = enter(nodes[0]);
+        if (t_root != FLT_MAX) {
+            stack[sp++] = {0, t_root};
+        }
+        while (sp > 0) {
+            Entry e = stack[--sp];
+            if (e.t >= t_max) {
+                continue;
+            }
+            const Node &n = nodes[e.node];
+            if (n.left < 0) {
+                for (int j = n.first; j < n.first + n.count; ++j) {
+                    visit(order[j], t_max);
+                }
+                continue;
+            }
+            float tl = enter(nodes[n.left]), tr = enter(nodes[n.left + 1]);
+            int near = n.left, far = n.left + 1;
+            if (tr < tl) {
+                std::swap(tl, tr);
+                std::swap(near, far);
+            }
+            if (tr != FLT_MAX) {
+                stack[sp++] = {far, tr};
+            }
+            if (tl != FLT_MAX) {
+                stack[sp++] = {near, tl};
+            }
+        }
+    }
+};
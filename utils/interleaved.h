@@ -0,0 +1,175 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "LiteMath.h"
+#include "public_camera.h"
+
+using LiteMath::float2;
+using LiteMath::float3;
+
+// Checkerboard / interleaved rendering with temporal reconstruction.
+// Each frame traces one phase of the pattern (1/2 of the pixels for the checkerboard, 1/4 for 2x2).
+// Every other pixel estimates its depth from traced neighbours, reprojects that point into the
+// previous frame and reuses the history colour if the history depth agrees (otherwise the pixel was
+// disoccluded and is filled from its traced neighbours). The world is static between frames, so the
+// depth test alone is enough to reject stale history.
+
+const float SKY_DEPTH = 1e30f;
+
+enum InterleaveMode {
+    INTERLEAVE_OFF,
+    INTERLEAVE_CHECKERBOARD,
+    INTERLEAVE_2X2
+};
+
+struct InterleavedHistory {
+    int width = 0;
+    int height = 0;
+    bool valid = false;
+    uint32_t frame = 0;
+    Camera camera;                 // camera of the frame stored in color/depth
+    std::vector<uint32_t> color;   // previous reconstructed frame
+    std::vector<float> depth;
+    std::vector<uint32_t> cur_color;
+    std::vector<float> cur_depth;
+    float depth_tolerance = 0.05f; // relative depth difference accepted as the same surface
+
+    void reset(int w, int h) {
+        width = w;
+        height = h;
+        valid = false;
+        color.assign(w * h, 0);
+        depth.assign(w * h, SKY_DEPTH);
+        cur_color.assign(w * h, 0);
+        cur_depth.assign(w * h, SKY_DEPTH);
+    }
+};
+
+inline bool is_traced_pixel(InterleaveMode mode, int x, int y, uint32_t frame) {
+    // 2x2 phases go along a diagonal first so consecutive frames cover the block evenly
+    static const int phase_2x2[4] = {0, 3, 1, 2};
+    switch (mode) {
+    case INTERLEAVE_CHECKERBOARD: return ((x + y + frame) & 1) == 0;
+    case INTERLEAVE_2X2:          return ((x & 1) + 2 * (y & 1)) == phase_2x2[frame & 3];
+    default:                      return true;
+    }
+}
+
+inline void unpack_rgb(uint32_t c, int rgb[3]) {
+    rgb[0] = (c >> 16) & 0xFF;
+    rgb[1] = (c >> 8) & 0xFF;
+    rgb[2] = c & 0xFF;
+}
+
+inline uint32_t pack_rgb(const int rgb[3]) {
+    return 0xFF000000 | (rgb[0] << 16) | (rgb[1] << 8) | rgb[2];
+}
+
+// trace(x, y, depth&) -> RGBA8, ray_dir(camera, x, y) -> float3,
+// project(camera, world_point, float2 &pixel) -> bool (false if the point is behind the camera)
+template <typename Trace, typename RayDir, typename Project>
+void interleaved_render(InterleavedHistory &history, InterleaveMode mode, const Camera &camera, uint32_t *out_image,
+                        int W, int H, Trace trace, RayDir ray_dir, Project project)
+{
+    if (history.width != W || history.height != H) {
+        history.reset(W, H);
+    }
+    uint32_t frame = history.frame;
+    uint32_t *cur_color = history.cur_color.data();
+    float *cur_depth = history.cur_depth.data();
+
+    #pragma omp parallel for
+    for (int y = 0; y < H; y++)
+    {
+        for (int x = 0; x < W; x++)
+        {
+            if (is_traced_pixel(mode, x, y, frame)) {
+                cur_color[y * W + x] = trace(x, y, cur_depth[y * W + x]);
+            }
+        }
+    }
+
+    #pragma omp parallel for
+    for (int y = 0; y < H; y++)
+    {
+        for (int x = 0; x < W; x++)
+        {
+            if (is_traced_pixel(mode, x, y, frame)) {
+                continue;
+            }
+
+            // traced neighbours: nearest depth and average colour
+            float near_depth = SKY_DEPTH;
+            int sum[3] = {0, 0, 0};
+            int count = 0;
+            for (int dy = -1; dy <= 1; ++dy) {
+                for (int dx = -1; dx <= 1; ++dx) {
+                    int nx = x + dx, ny = y + dy;
+                    if (nx < 0 || ny < 0 || nx >= W || ny >= H || !is_traced_pixel(mode, nx, ny, frame)) {
+                        continue;
+                    }
+                    int rgb[3];
+                    unpack_rgb(cur_color[ny * W + nx], rgb);
+                    for (int c = 0; c < 3; ++c) {
+                        sum[c] += rgb[c];
+                    }
+                    near_depth = std::min(near_depth, cur_depth[ny * W + nx]);
+                    count++;
+                }
+            }
+            if (count == 0) {
+                // only possible on a 1 pixel wide border, trace it
+                cur_color[y * W + x] = trace(x, y, cur_depth[y * W + x]);
+                continue;
+            }
+            int avg[3] = {sum[0] / count, sum[1] / count, sum[2] / count};
+            uint32_t result = pack_rgb(avg);
+            cur_depth[y * W + x] = near_depth;
+
+            if (history.valid) {
+                int px = -1, py = -1;
+                float expected_depth = SKY_DEPTH;
+                if (near_depth >= SKY_DEPTH) {
+                    // sky does not move with the camera position, reproject by direction only
+                    float2 xy;
+                    if (project(history.camera, history.camera.pos + ray_dir(camera, x, y), xy)) {
+                        px = (int)std::floor(xy.x + 0.5f);
+                        py = (int)std::floor(xy.y + 0.5f);
+                    }
+                } else {
+                    float3 p = camera.pos + ray_dir(camera, x, y) * near_depth;
+                    float2 xy;
+                    if (project(history.camera, p, xy)) {
+                        px = (int)std::floor(xy.x + 0.5f);
+                        py = (int)std::floor(xy.y + 0.5f);
+                        expected_depth = length(p - history.camera.pos);
+                    }
+                }
+
+                if (px >= 0 && py >= 0 && px < W && py < H) {
+                    float hist_depth = history.depth[py * W + px];
+                    bool same_surface = expected_depth >= SKY_DEPTH
+                        ? hist_depth >= SKY_DEPTH
+                        : std::abs(hist_depth - expected_depth) <= history.depth_tolerance * expected_depth + 0.05f;
+                    if (same_surface) {
+                        result = history.color[py * W + px];
+                        if (expected_depth < SKY_DEPTH) {
+                            cur_depth[y * W + x] = near_depth + (hist_depth - expected_depth);
+                        }
+                    }
+                }
+            }
+            cur_color[y * W + x] = result;
+        }
+    }
+
+    std::copy(history.cur_color.begin(), history.cur_color.end(), out_image);
+    std::swap(history.color, history.cur_color);
+    std::swap(history.depth, history.cur_depth);
+    history.camera = camera;
+    history.valid = true;
+    history.frame++;
+}
@@ -0,0 +1,432 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "LiteMath.h"
+#include "blocks.h"
+#include "voxel_octree.h"
+
+using LiteMath::float3;
+using LiteMath::int3;
+
+// Flood fill lighting with sky light and block light, 4 bits each per voxel.
+// The engine keeps its own copy of the blocks in LIGHT_CHUNK^3 chunks (one byte of block id and one
+// byte of light, sky << 4 | block, per voxel); while all voxels of a chunk share a block id or a light
+// value, as in open air or deep stone, that array is a single value. Light spreads to the 6 neighbours losing one level per
+// step (two through water); sky light at level 15 also falls straight down without loss. Missing
+// chunks count as open air under the sky.
+// Edits run the usual two-queue BFS: cells lit through an edited cell are cleared by the remove
+// queue, whose brighter boundary cells then refill the hole through the add queue, so an edit only
+// touches the cells its light reaches, in whichever chunks they are. Whole chunks are lit in
+// parallel, each inside its own bounds first, followed by one BFS across the chunk borders.
+
+const int LIGHT_CHUNK = 32;
+const int LIGHT_MAX = 15;
+const int LIGHT_SKY = 0;
+const int LIGHT_BLOCK = 1;
+
+// Brightness of light levels: the three levels below full fade gently to 0.8 so light stays bright
+// next to its source, below level 12 every missing level is a factor 0.8
+const float LIGHT_SHADE[16] = {
+    0.06f, 0.07f, 0.09f, 0.11f, 0.13f, 0.17f, 0.21f, 0.26f,
+    0.33f, 0.41f, 0.51f, 0.64f, 0.80f, 0.84f, 0.92f, 1.0f
+};
+
+const int3 light_dirs[6] = {int3(1, 0, 0), int3(-1, 0, 0), int3(0, 0, 1), int3(0, 0, -1), int3(0, 1, 0), int3(0, -1, 0)};
+const int LIGHT_DOWN = 5;
+
+const int LIGHT_CHUNK_VOXELS = LIGHT_CHUNK * LIGHT_CHUNK * LIGHT_CHUNK;
+
+struct LightChunk {
+    int3 coord;
+    // empty while every voxel holds the uniform value, allocated on the first write of another one
+    std::vector<uint8_t> block, light;
+    uint8_t uniform_block = EMPTY;
+    uint8_t uniform_light = 0;
+    uint32_t version = 0;   // bumped on every change of a block or a light level
+
+    static int index(int3 local) { return grid_index(local.x, local.y, local.z, LIGHT_CHUNK); }
+
+    // Stores LIGHT_CHUNK_VOXELS values into data, or only uniform if they are all the same
+    static void assign(std::vector<uint8_t> &data, uint8_t &uniform, const uint8_t *values) {
+        uniform = values[0];
+        if (std::all_of(values, values + LIGHT_CHUNK_VOXELS, [&](uint8_t v) { return v == uniform; })) {
+            std::vector<uint8_t>().swap(data);
+        } else {
+            data.assign(values, values + LIGHT_CHUNK_VOXELS);
+        }
+    }
+
+    static void write(std::vector<uint8_t> &data, uint8_t uniform, int i, uint8_t value) {
+        if (data.empty()) {
+            data.assign(LIGHT_CHUNK_VOXELS, uniform);
+        }
+        data[i] = value;
+    }
+
+    int get_block(int i) const { return block.empty() ? uniform_block : block[i]; }
+    void set_block(int i, int block_id) {
+        if (get_block(i) != block_id) {
+            write(block, uniform_block, i, block_id);
+            version++;
+        }
+    }
+
+    int get(int i, int channel) const {
+        int value = light.empty() ? uniform_light : light[i];
+        return channel == LIGHT_SKY ? value >> 4 : value & 15;
+    }
+    void set(int i, int channel, int level) {
+        int value = light.empty() ? uniform_light : light[i];
+        value = channel == LIGHT_SKY ? (value & 15) | (level << 4) : (value & 0xf0) | level;
+        if (!light.empty() || value != uniform_light) {
+            write(light, uniform_light, i, value);
+        }
+        version++;
+    }
+};
+
+struct LightEngine {
+    struct Edit { int3 pos; int block_id; };
+    struct Removal { int3 pos; int level; };
+
+    std::vector<std::unique_ptr<LightChunk>> chunks;
+    std::unordered_map<uint64_t, int> chunk_by_coord;
+    std::vector<Edit> pending;
+    int emission[BLOCK_TYPES + 1] = {};    // block light emitted per block id
+
+    static uint64_t key(int3 c) {
+        return (uint64_t(uint32_t(c.x) & 0x1fffff) << 42) | (uint64_t(uint32_t(c.y) & 0x1fffff) << 21) | uint64_t(uint32_t(c.z) & 0x1fffff);
+    }
+    static int chunk_coord(int v) { return v >= 0 ? v / LIGHT_CHUNK : -((-v + LIGHT_CHUNK - 1) / LIGHT_CHUNK); }
+    static int3 chunk_of(int3 p) { return int3(chunk_coord(p.x), chunk_coord(p.y), chunk_coord(p.z)); }
+
+    // Light loss when light enters a voxel of this block, 0 if it blocks light
+    static int attenuation(int block_id) {
+        if (block_id == EMPTY) return 1;
+        if (block_id == WATER) return 2;
+        return 0;
+    }
+
+    bool empty() const { return chunks.empty(); }
+
+    LightChunk * find_chunk(int3 c) const {
+        auto it = chunk_by_coord.find(key(c));
+        return it == chunk_by_coord.end() ? nullptr : chunks[it->second].get();
+    }
+
+    LightChunk * add_chunk(int3 c) {
+        if (LightChunk *chunk = find_chunk(c)) {
+            return chunk;
+        }
+        chunks.emplace_back(new LightChunk);
+        chunks.back()->coord = c;
+        chunk_by_coord[key(c)] = (int)chunks.size() - 1;
+        return chunks.back().get();
+    }
+
+    // Voxel lookups through a one chunk cache; a cell is a chunk (nullptr if missing) and an index
+    struct Cursor {
+        const LightEngine &engine;
+        int3 coord = int3(INT32_MAX);
+        LightChunk *chunk = nullptr;
+
+        LightChunk * at(int3 p, int &i) {
+            int3 c = chunk_of(p);
+            if (c.x != coord.x || c.y != coord.y || c.z != coord.z) {
+                coord = c;
+                chunk = engine.find_chunk(c);
+            }
+            i = LightChunk::index(p - c * LIGHT_CHUNK);
+            return chunk;
+        }
+    };
+
+    int get_light(int3 p, int channel) const {
+        Cursor cursor{*this};
+        int i;
+        LightChunk *chunk = cursor.at(p, i);
+        if (!chunk) {
+            return channel == LIGHT_SKY ? LIGHT_MAX : 0;
+        }
+        return chunk->get(i, channel);
+    }
+
+    int get_block(int3 p) const {
+        Cursor cursor{*this};
+        int i;
+        LightChunk *chunk = cursor.at(p, i);
+        return chunk ? chunk->get_block(i) : (int)EMPTY;
+    }
+
+    // Shade factor of the voxel at p, the brighter of both channels
+    float shade(int3 p) const {
+        Cursor cursor{*this};
+        int i;
+        LightChunk *chunk = cursor.at(p, i);
+        return chunk ? LIGHT_SHADE[std::max(chunk->get(i, LIGHT_SKY), chunk->get(i, LIGHT_BLOCK))] : 1.0f;
+    }
+
+    // Spreads light from the queued cells. With only set, neighbours outside that chunk are ignored.
+    void propagate_add(std::vector<int3> &queue, int channel, const LightChunk *only = nullptr) {
+        Cursor cursor{*this};
+        for (size_t head = 0; head < queue.size(); ++head) {
+            int3 p = queue[head];
+            int i;
+            LightChunk *chunk = cursor.at(p, i);
+            if (!chunk) {
+                continue;
+            }
+            int level = chunk->get(i, channel);
+            for (int d = 0; d < 6; ++d) {
+                int3 n = p + light_dirs[d];
+                int j;
+                LightChunk *next = cursor.at(n, j);
+                if (!next || (only && next != only)) {
+                    continue;
+                }
+                int loss = attenuation(next->get_block(j));
+                if (loss == 0) {
+                    continue;
+                }
+                bool falls = channel == LIGHT_SKY && d == LIGHT_DOWN && level == LIGHT_MAX && loss == 1;
+                int new_level = falls ? LIGHT_MAX : level - loss;
+                if (new_level > next->get(j, channel)) {
+                    next->set(j, channel, new_level);
+                    queue.push_back(n);
+                }
+            }
+        }
+        queue.clear();
+    }
+
+    // Sky light a transparent cell gets from missing neighbour chunks (open sky); queues it if brighter
+    void light_from_open_sky(int3 p, std::vector<int3> &queue) {
+        Cursor cursor{*this};
+        int i;
+        LightChunk *chunk = cursor.at(p, i);
+        int loss = chunk ? attenuation(chunk->get_block(i)) : 0;
+        if (loss == 0) {
+            return;
+        }
+        int level = 0;
+        for (int d = 0; d < 6; ++d) {
+            if (!find_chunk(chunk_of(p + light_dirs[d]))) {
+                // light falling from the sky above keeps its level
+                level = std::max(level, d == 4 && loss == 1 ? LIGHT_MAX : LIGHT_MAX - loss);
+            }
+        }
+        if (level > chunk->get(i, LIGHT_SKY)) {
+            chunk->set(i, LIGHT_SKY, level);
+            queue.push_back(p);
+        }
+    }
+
+    // Clears the light that came through the queued cells (already set to 0, level is their old
+    // value) and queues the brighter cells around the cleared region for propagate_add
+    void propagate_remove(std::vector<Removal> &queue, std::vector<int3> &add_queue, int channel) {
+        Cursor cursor{*this};
+        for (size_t head = 0; head < queue.size(); ++head) {
+            Removal r = queue[head];
+            for (int d = 0; d < 6; ++d) {
+                int3 n = r.pos + light_dirs[d];
+                int j;
+                LightChunk *next = cursor.at(n, j);
+                if (!next) {
+                    if (channel == LIGHT_SKY) {
+                        light_from_open_sky(r.pos, add_queue);
+                    }
+                    continue;
+                }
+                int level = next->get(j, channel);
+                if (level == 0) {
+                    continue;
+                }
+                bool fell = channel == LIGHT_SKY && d == LIGHT_DOWN && r.level == LIGHT_MAX && level == LIGHT_MAX;
+                if (level < r.level || fell) {
+                    next->set(j, channel, 0);
+                    queue.push_back(Removal{n, level});
+                } else {
+                    add_queue.push_back(n);
+                }
+            }
+        }
+        queue.clear();
+    }
+
+    void set_block(int3 p, int block_id) { pending.push_back(Edit{p, block_id}); }
+
+    // Applies the pending edits with incremental relighting; call once per frame
+    void update() {
+        if (pending.empty()) {
+            return;
+        }
+        std::vector<Removal> removals;
+        std::vector<int3> adds;
+        for (int channel = 0; channel < 2; ++channel) {
+            for (const Edit &e : pending) {
+                int i;
+                Cursor cursor{*this};
+                LightChunk *chunk = cursor.at(e.pos, i);
+                if (!chunk) {
+                    continue;
+                }
+                if (channel == LIGHT_SKY) {
+                    chunk->set_block(i, e.block_id);
+                }
+                int level = chunk->get(i, channel);
+                if (level > 0) {
+                    chunk->set(i, channel, 0);
+                    removals.push_back(Removal{e.pos, level});
+                }
+            }
+            propagate_remove(removals, adds, channel);
+
+            for (const Edit &e : pending) {
+                int i;
+                Cursor cursor{*this};
+                LightChunk *chunk = cursor.at(e.pos, i);
+                if (!chunk) {
+                    continue;
+                }
+                if (attenuation(e.block_id) != 0) {
+                    // the neighbours light the opened cell
+                    for (int d = 0; d < 6; ++d) {
+                        adds.push_back(e.pos + light_dirs[d]);
+                    }
+                    if (channel == LIGHT_SKY) {
+                        light_from_open_sky(e.pos, adds);
+                    }
+                }
+                if (channel == LIGHT_BLOCK && emission[e.block_id] > chunk->get(i, LIGHT_BLOCK)) {
+                    chunk->set(i, LIGHT_BLOCK, emission[e.block_id]);
+                    adds.push_back(e.pos);
+                }
+            }
+            propagate_add(adds, channel);
+        }
+        pending.clear();
+    }
+
+    // Lights every chunk from scratch: sky columns and emitters, a BFS inside each chunk (in
+    // parallel), then one BFS seeded from the chunk borders
+    void light_all() {
+        // chunk columns top to bottom, sky comes in where the chunk above is missing
+        std::unordered_map<uint64_t, std::vector<LightChunk *>> columns;
+        for (auto &chunk : chunks) {
+            columns[key(int3(chunk->coord.x, 0, chunk->coord.z))].push_back(chunk.get());
+        }
+        std::vector<std::vector<LightChunk *>> column_list;
+        for (auto &column : columns) {
+            std::sort(column.second.begin(), column.second.end(), [](LightChunk *a, LightChunk *b) { return a->coord.y > b->coord.y; });
+            column_list.push_back(std::move(column.second));
+        }
+
+        #pragma omp parallel for schedule(dynamic)
+        for (int c = 0; c < (int)column_list.size(); ++c) {
+            const std::vector<LightChunk *> &column = column_list[c];
+            std::vector<uint8_t> light(LIGHT_CHUNK_VOXELS);
+            std::vector<bool> sky(LIGHT_CHUNK * LIGHT_CHUNK, true);    // per x, z: still lit from above
+            for (size_t k = 0; k < column.size(); ++k) {
+                if (k > 0 && column[k]->coord.y != column[k - 1]->coord.y - 1) {
+                    sky.assign(sky.size(), true);
+                }
+                for (int x = 0; x < LIGHT_CHUNK; ++x) {
+                    for (int z = 0; z < LIGHT_CHUNK; ++z) {
+                        bool lit = sky[x * LIGHT_CHUNK + z];
+                        for (int y = LIGHT_CHUNK - 1; y >= 0; --y) {
+                            int i = LightChunk::index(int3(x, y, z));
+                            int id = column[k]->get_block(i);
+                            lit = lit && attenuation(id) == 1;
+                            light[i] = (lit ? LIGHT_MAX << 4 : 0) | emission[id];
+                        }
+                        sky[x * LIGHT_CHUNK + z] = lit;
+                    }
+                }
+                LightChunk::assign(column[k]->light, column[k]->uniform_light, light.data());
+            }
+        }
+
+        #pragma omp parallel for schedule(dynamic)
+        for (int c = 0; c < (int)chunks.size(); ++c) {
+            LightChunk *chunk = chunks[c].get();
+            int3 base = chunk->coord * LIGHT_CHUNK;
+            for (int channel = 0; channel < 2; ++channel) {
+                std::vector<int3> queue;
+                for (int x = 0; x < LIGHT_CHUNK; ++x) {
+                    for (int z = 0; z < LIGHT_CHUNK; ++z) {
+                        for (int y = 0; y < LIGHT_CHUNK; ++y) {
+                            if (chunk->get(LightChunk::index(int3(x, y, z)), channel) > 1) {
+                                queue.push_back(base + int3(x, y, z));
+                            }
+                        }
+                    }
+                }
+                propagate_add(queue, channel, chunk);
+            }
+        }
+
+        // across borders, including the open sky around missing neighbours
+        for (int channel = 0; channel < 2; ++channel) {
+            std::vector<int3> queue;
+            for (auto &chunk : chunks) {
+                int3 base = chunk->coord * LIGHT_CHUNK;
+                for (int d = 0; d < 6; ++d) {
+                    bool missing = !find_chunk(chunk->coord + light_dirs[d]);
+                    int axis = d < 2 ? 0 : (d < 4 ? 2 : 1);
+                    int side = d % 2 == 0 ? LIGHT_CHUNK - 1 : 0;
+                    for (int a = 0; a < LIGHT_CHUNK; ++a) {
+                        for (int b = 0; b < LIGHT_CHUNK; ++b) {
+                            int3 local = axis == 0 ? int3(side, a, b) : (axis == 1 ? int3(a, side, b) : int3(a, b, side));
+                            int i = LightChunk::index(local);
+                            if (missing && channel == LIGHT_SKY) {
+                                light_from_open_sky(base + local, queue);
+                            }
+                            if (chunk->get(i, channel) > 1) {
+                                queue.push_back(base + local);
+                            }
+                        }
+                    }
+                }
+            }
+            propagate_add(queue, channel);
+        }
+    }
+
+    // Copies the blocks of an encoded octree of the given size with minimum corner origin, adding
+    // chunks as needed; call light_all afterwards
+    void load_octree(const unsigned int *nodes, const unsigned int *far, int size, int3 origin) {
+        int3 c0 = chunk_of(origin), c1 = chunk_of(origin + int3(size - 1));
+        std::vector<LightChunk *> added;
+        for (int x = c0.x; x <= c1.x; ++x) {
+            for (int y = c0.y; y <= c1.y; ++y) {
+                for (int z = c0.z; z <= c1.z; ++z) {
+                    added.push_back(add_chunk(int3(x, y, z)));
+                }
+            }
+        }
+        #pragma omp parallel
+        {
+            std::vector<uint8_t> block(LIGHT_CHUNK_VOXELS);
+            #pragma omp for schedule(dynamic)
+            for (int c = 0; c < (int)added.size(); ++c) {
+                int3 base = added[c]->coord * LIGHT_CHUNK;
+                for (int x = 0; x < LIGHT_CHUNK; ++x) {
+                    for (int z = 0; z < LIGHT_CHUNK; ++z) {
+                        for (int y = 0; y < LIGHT_CHUNK; ++y) {
+                            int3 p = base + int3(x, y, z) - origin;
+                            int i = LightChunk::index(int3(x, y, z));
+                            bool inside = p.x >= 0 && p.y >= 0 && p.z >= 0 && p.x < size && p.y < size && p.z < size;
+                            block[i] = inside ? octree_block_at(nodes, far, size, p) : added[c]->get_block(i);
+                        }
+                    }
+                }
+                LightChunk::assign(added[c]->block, added[c]->uniform_block, block.data());
+            }
+        }
+    }
+};
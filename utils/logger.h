@@ -0,0 +1,289 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+// Asynchronous logger.
+// The calling thread only copies the format string pointer and the raw arguments into a bounded
+// lock-free queue; formatting and I/O happen on a background thread. When the queue is full the
+// record is dropped and counted instead of blocking the caller.
+//
+// Format strings must be string literals. "{}" prints the next argument with a default format,
+// "{%.2f}" uses the given printf conversion for it.
+
+enum LogLevel {
+    LOG_LEVEL_TRACE,
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_OFF
+};
+
+const char *log_level_names[LOG_LEVEL_OFF] = {"TRACE", "DEBUG", "INFO", "WARN", "ERROR"};
+
+struct LogArg {
+    enum Type : uint8_t { INT, UINT, DOUBLE, STR } type;
+    union {
+        int64_t i;
+        uint64_t u;
+        double d;
+        const char *s;
+    };
+
+    LogArg() : type(INT), i(0) {}
+    LogArg(int v) : type(INT), i(v) {}
+    LogArg(long v) : type(INT), i(v) {}
+    LogArg(long long v) : type(INT), i(v) {}
+    LogArg(unsigned v) : type(UINT), u(v) {}
+    LogArg(unsigned long v) : type(UINT), u(v) {}
+    LogArg(unsigned long long v) : type(UINT), u(v) {}
+    LogArg(float v) : type(DOUBLE), d(v) {}
+    LogArg(double v) : type(DOUBLE), d(v) {}
+    LogArg(const char *v) : type(STR), s(v) {} // must outlive the record (literals, static tables)
+};
+
+struct LogRecord {
+    static constexpr int MAX_ARGS = 8;
+
+    std::atomic<uint64_t> seq;
+    LogLevel level;
+    int nargs;
+    int64_t time_ns;
+    const char *fmt;
+    LogArg args[MAX_ARGS];
+};
+
+struct Logger {
+    static constexpr uint32_t CAPACITY = 1 << 12; // must be a power of two
+
+    std::vector<LogRecord> records;
+    std::atomic<uint64_t> enqueue_pos{0};
+    uint64_t dequeue_pos = 0; // consumer only
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<int> min_level{LOG_LEVEL_INFO};
+    std::atomic<bool> running{false};
+    std::thread worker;
+    FILE *out = stdout;
+    std::chrono::steady_clock::time_point epoch;
+
+    Logger() : records(CAPACITY), epoch(std::chrono::steady_clock::now()) {
+        for (uint32_t i = 0; i < CAPACITY; ++i) {
+            records[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+    ~Logger() { stop(); }
+
+    void start(FILE *out1 = stdout) {
+        if (running.exchange(true)) {
+            return;
+        }
+        out = out1;
+        worker = std::thread([this]() { run(); });
+    }
+
+    // Drains everything that is still queued and joins the background thread.
+    void stop() {
+        if (!running.exchange(false)) {
+            return;
+        }
+        worker.join();
+        flush_pending();
+    }
+
+    bool enabled(LogLevel level) const { return level >= min_level.load(std::memory_order_relaxed); }
+
+    template <typename... Args>
+    void write(LogLevel level, const char *fmt, Args... args) {
+        static_assert(sizeof...(Args) <= LogRecord::MAX_ARGS, "too many log arguments");
+        if (!enabled(level)) {
+            return;
+        }
+        // bounded MPSC queue: each slot's sequence tells producers and the consumer whose turn it is
+        uint64_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        LogRecord *r;
+        for (;;) {
+            r = &records[pos & (CAPACITY - 1)];
+            uint64_t seq = r->seq.load(std::memory_order_acquire);
+            int64_t diff = (int64_t)seq - (int64_t)pos;
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            } else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        r->level = level;
+        r->time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+        r->fmt = fmt;
+        r->nargs = sizeof...(Args);
+        LogArg packed[] = {LogArg(args)..., LogArg()};
+        for (int i = 0; i < r->nargs; ++i) {
+            r->args[i] = packed[i];
+        }
+        r->seq.store(pos + 1, std::memory_order_release);
+    }
+
+    void run() {
+        while (running.load(std::memory_order_acquire)) {
+            if (flush_pending() == 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            }
+        }
+    }
+
+    int flush_pending() {
+        char line[1024];
+        int count = 0;
+        for (;;) {
+            LogRecord &r = records[dequeue_pos & (CAPACITY - 1)];
+            if (r.seq.load(std::memory_order_acquire) != dequeue_pos + 1) {
+                break;
+            }
+            int len = format_record(r, line, sizeof(line));
+            fwrite(line, 1, len, out);
+            r.seq.store(dequeue_pos + CAPACITY, std::memory_order_release);
+            dequeue_pos++;
+            count++;
+        }
+        uint64_t lost = dropped.exchange(0, std::memory_order_relaxed);
+        if (lost != 0) {
+            fprintf(out, "[Logger::WARNING] %llu records dropped, queue was full\n", (unsigned long long)lost);
+        }
+        if (count != 0 || lost != 0) {
+            fflush(out);
+        }
+        return count;
+    }
+
+    // A user spec keeps its flags, width and precision; the length modifier is replaced and the value
+    // converted to what the conversion expects, so "{%d}" with an int64_t is still well defined.
+    // Specs that do not fit the argument (e.g. "%s" with a number) fall back to the default format.
+    static int format_arg(const LogArg &a, const char *spec, char *buf, int size) {
+        if (spec) {
+            char fixed[24];
+            int n = 0;
+            const char *p = spec + 1;
+            fixed[n++] = '%';
+            while (*p && strchr("-+ #0123456789.", *p) && n < 12) {
+                fixed[n++] = *p++;
+            }
+            while (*p && strchr("hlLqjzt", *p)) {
+                p++;
+            }
+            char conv = *p;
+            long long as_int = a.type == LogArg::INT ? (long long)a.i : a.type == LogArg::UINT ? (long long)a.u : (long long)a.d;
+            unsigned long long as_uint = a.type == LogArg::INT ? (unsigned long long)a.i :
+                                         a.type == LogArg::UINT ? a.u : (unsigned long long)a.d;
+            double as_double = a.type == LogArg::INT ? (double)a.i : a.type == LogArg::UINT ? (double)a.u : a.d;
+            if (conv && a.type != LogArg::STR && strchr("diuoxXc", conv)) {
+                if (conv != 'c') {
+                    fixed[n++] = 'l';
+                    fixed[n++] = 'l';
+                }
+                fixed[n++] = conv;
+                fixed[n] = '\0';
+                if (conv == 'c') return snprintf(buf, size, fixed, (int)as_int);
+                if (conv == 'd' || conv == 'i') return snprintf(buf, size, fixed, as_int);
+                return snprintf(buf, size, fixed, as_uint);
+            }
+            if (conv && a.type != LogArg::STR && strchr("fFeEgGaA", conv)) {
+                fixed[n++] = conv;
+                fixed[n] = '\0';
+                return snprintf(buf, size, fixed, as_double);
+            }
+            if (conv == 's' && a.type == LogArg::STR) {
+                fixed[n++] = 's';
+                fixed[n] = '\0';
+                return snprintf(buf, size, fixed, a.s ? a.s : "(null)");
+            }
+        }
+        switch (a.type) {
+        case LogArg::INT:    return snprintf(buf, size, "%lld", (long long)a.i);
+        case LogArg::UINT:   return snprintf(buf, size, "%llu", (unsigned long long)a.u);
+        case LogArg::DOUBLE: return snprintf(buf, size, "%g", a.d);
+        case LogArg::STR:    return snprintf(buf, size, "%s", a.s ? a.s : "(null)");
+        }
+        return 0;
+    }
+
+    static int format_record(const LogRecord &r, char *buf, int size) {
+        int len = snprintf(buf, size, "[%10.3f %-5s] ", r.time_ns * 1e-9, log_level_names[r.level]);
+        int arg = 0;
+        const char *p = r.fmt;
+        while (*p && len < size - 2) {
+            if (p[0] == '{' && arg < r.nargs) {
+                const char *close = strchr(p, '}');
+                if (close) {
+                    char spec[16];
+                    const char *spec_ptr = nullptr;
+                    int spec_len = (int)(close - p - 1);
+                    if (spec_len > 0 && p[1] == '%' && spec_len < (int)sizeof(spec)) {
+                        memcpy(spec, p + 1, spec_len);
+                        spec[spec_len] = '\0';
+                        spec_ptr = spec;
+                    }
+                    int n = format_arg(r.args[arg++], spec_ptr, buf + len, size - 1 - len);
+                    len = std::min(len + std::max(n, 0), size - 2);
+                    p = close + 1;
+                    continue;
+                }
+            }
+            buf[len++] = *p++;
+        }
+        buf[len++] = '\n';
+        buf[len] = '\0';
+        return len;
+    }
+};
+
+Logger logger;
+
+LogLevel parse_log_level(const char *name) {
+    auto same = [](const char *a, const char *b) {
+        for (; *a && *b; ++a, ++b) {
+            if (toupper((unsigned char)*a) != *b) {
+                return false;
+            }
+        }
+        return *a == *b;
+    };
+    for (int i = 0; i < LOG_LEVEL_OFF; ++i) {
+        if (same(name, log_level_names[i])) {
+            return (LogLevel)i;
+        }
+    }
+    return same(name, "OFF") ? LOG_LEVEL_OFF : LOG_LEVEL_INFO;
+}
+
+#define LOG(level, ...) logger.write(level, __VA_ARGS__)
+#define LOG_TRACE(...) LOG(LOG_LEVEL_TRACE, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...)  LOG(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN(...)  LOG(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR(...) LOG(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+// Rate limited: logs at most once per interval_ms from this call site, later calls are skipped.
+#define LOG_EVERY_MS(level, interval_ms, ...)                                                          \
+    do {                                                                                               \
+        static std::atomic<int64_t> log_last_ns_{INT64_MIN / 2};                                           \
+        if (logger.enabled(level)) {                                                                   \
+            int64_t log_now_ns_ = std::chrono::duration_cast<std::chrono::nanoseconds>(                \
+                std::chrono::steady_clock::now().time_since_epoch()).count();                          \
+            int64_t log_prev_ns_ = log_last_ns_.load(std::memory_order_relaxed);                       \
+            if (log_now_ns_ - log_prev_ns_ >= (int64_t)(interval_ms) * 1000000 &&                      \
+                log_last_ns_.compare_exchange_strong(log_prev_ns_, log_now_ns_, std::memory_order_relaxed)) { \
+                logger.write(level, __VA_ARGS__);                                                      \
+            }                                                                                          \
+        }                                                                                              \
+    } while (0)
@@ -1,57 +1,126 @@
+#include <algorithm>
 #include <cfloat>
+#include <charconv>
 #include <cstring>
 #include <fstream>
 #include <cstdio>
 #include <unordered_map>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
 
 #include "mesh.h"
+#include "mapped_file.h"
 
 namespace cmesh4 {
 
+// OBJ text is formatted with std::to_chars in blocks of OBJ_BLOCK_LINES lines. A wave of blocks is
+// formatted in parallel into fixed buffers and written in order, so memory does not grow with the mesh.
+static const size_t OBJ_BLOCK_LINES = 16384;
+static const size_t OBJ_MAX_LINE = 128;
+
+static inline char *put_float(char *p, float value)
+{
+  return std::to_chars(p, p + 32, value).ptr;
+}
+
+static inline char *put_uint(char *p, unsigned value)
+{
+  return std::to_chars(p, p + 16, value).ptr;
+}
+
+// format(p, i) writes line i (at most OBJ_MAX_LINE bytes) at p and returns its end
+template <typename Format>
+static bool write_obj_lines(FILE *out, size_t count, std::vector<std::vector<char>> &buffers, std::vector<size_t> &sizes, Format format)
+{
+  const size_t wave = buffers.size();
+  for (size_t first_block = 0; first_block * OBJ_BLOCK_LINES < count; first_block += wave)
+  {
+    #pragma omp parallel for schedule(dynamic)
+    for (int b = 0; b < (int)wave; ++b)
+    {
+      size_t begin = (first_block + b) * OBJ_BLOCK_LINES;
+      size_t end = std::min(begin + OBJ_BLOCK_LINES, count);
+      char *p = buffers[b].data();
+      for (size_t i = begin; i < end; ++i)
+        p = format(p, i);
+      sizes[b] = begin < end ? p - buffers[b].data() : 0;
+    }
+    for (size_t b = 0; b < wave; ++b)
+    {
+      if (sizes[b] > 0 && fwrite(buffers[b].data(), 1, sizes[b], out) != sizes[b])
+        return false;
+    }
+  }
+  return true;
+}
+
 void SaveMeshToObj(const char* a_fileName, const SimpleMesh &mesh)
 {
-  std::ofstream out(a_fileName);
+  FILE *out = fopen(a_fileName, "wb");
   if (!out)
   {
     printf("[SaveMeshToObj::ERROR] Failed to create output file: %s\n", a_fileName);
     return;
   }
 
-  std::string header = "# obj file created by custom obj loader\n";
-  std::string o_data = "o MainModel\n";
-  std::string v_data;
-  std::string tc_data;
-  std::string n_data;
-  std::string s_data = "s off\n";
-  std::string f_data;
-
-  int sz = mesh.vPos4f.size();
+  size_t sz = mesh.vPos4f.size();
   assert(mesh.vNorm4f.size() == sz);
   assert(mesh.vTexCoord2f.size() == sz);
 
-  for (int i = 0; i < sz; ++i)
-  {
-    v_data += "v " + std::to_string(mesh.vPos4f[i].x) + " " + std::to_string(mesh.vPos4f[i].y) + " " + std::to_string(mesh.vPos4f[i].z) + "\n";
-    n_data += "vn " + std::to_string(mesh.vNorm4f[i].x) + " " + std::to_string(mesh.vNorm4f[i].y) + " " + std::to_string(mesh.vNorm4f[i].z) + "\n";
-    tc_data += "vt " + std::to_string(mesh.vTexCoord2f[i].x) + " " + std::to_string(mesh.vTexCoord2f[i].y) + "\n";
-  }
-  for (int i = 0; i < mesh.indices.size() / 3; ++i)
-  {
-    f_data += "f " + std::to_string(mesh.indices[3*i]+1) + "/" + std::to_string(mesh.indices[3*i]+1) + "/" + std::to_string(mesh.indices[3*i]+1) + " " +
-      std::to_string(mesh.indices[3*i+1]+1) + "/" + std::to_string(mesh.indices[3*i+1]+1) + "/" + std::to_string(mesh.indices[3*i+1]+1) + " " +
-      std::to_string(mesh.indices[3*i+2]+1) + "/" + std::to_string(mesh.indices[3*i+2]+1) + "/" + std::to_string(mesh.indices[3*i+2]+1) + "\n";
-  }
-  out << header;
-  out << o_data;
-  out << v_data;
-  out << tc_data;
-  out << n_data;
-  out << s_data;
-  out << f_data;
-  out.close();
+  int threads = 1;
+  #ifdef _OPENMP
+  threads = omp_get_max_threads();
+  #endif
+  std::vector<std::vector<char>> buffers(2 * threads, std::vector<char>(OBJ_BLOCK_LINES * OBJ_MAX_LINE));
+  std::vector<size_t> sizes(buffers.size(), 0);
+
+  fputs("# obj file created by custom obj loader\n", out);
+  fputs("o MainModel\n", out);
+  bool ok = write_obj_lines(out, sz, buffers, sizes, [&](char *p, size_t i) {
+    const float4 &v = mesh.vPos4f[i];
+    *p++ = 'v'; *p++ = ' ';
+    p = put_float(p, v.x); *p++ = ' ';
+    p = put_float(p, v.y); *p++ = ' ';
+    p = put_float(p, v.z); *p++ = '\n';
+    return p;
+  });
+  ok = ok && write_obj_lines(out, sz, buffers, sizes, [&](char *p, size_t i) {
+    const float2 &t = mesh.vTexCoord2f[i];
+    *p++ = 'v'; *p++ = 't'; *p++ = ' ';
+    p = put_float(p, t.x); *p++ = ' ';
+    p = put_float(p, t.y); *p++ = '\n';
+    return p;
+  });
+  ok = ok && write_obj_lines(out, sz, buffers, sizes, [&](char *p, size_t i) {
+    const float4 &n = mesh.vNorm4f[i];
+    *p++ = 'v'; *p++ = 'n'; *p++ = ' ';
+    p = put_float(p, n.x); *p++ = ' ';
+    p = put_float(p, n.y); *p++ = ' ';
+    p = put_float(p, n.z); *p++ = '\n';
+    return p;
+  });
+  ok = ok && fputs("s off\n", out) >= 0;
+  ok = ok && write_obj_lines(out, mesh.indices.size() / 3, buffers, sizes, [&](char *p, size_t i) {
+    *p++ = 'f';
+    for (int k = 0; k < 3; ++k)
+    {
+      unsigned index = mesh.indices[3*i+k] + 1;
+      *p++ = ' ';
+      p = put_uint(p, index); *p++ = '/';
+      p = put_uint(p, index); *p++ = '/';
+      p = put_uint(p, index);
+    }
+    *p++ = '\n';
+    return p;
+  });
+
+  if (fclose(out) != 0 || !ok)
+    printf("[SaveMeshToObj::ERROR] Failed to write output file: %s\n", a_fileName);
 }
 
 bool check_is_valid(const cmesh4::SimpleMesh &mesh, bool verbose)
@@ -171,7 +240,7 @@ struct TinyObjIndexHasher
   }
 };
 
-SimpleMesh LoadMeshFromObj(const char* a_fileName, bool verbose)
+static SimpleMesh LoadMeshFromObjTinyObj(const char* a_fileName, bool verbose)
 {
   if (verbose)
     printf("[LoadMesh::INFO] Loading OBJ file %s\n", a_fileName);
@@ -282,4 +351,735 @@ SimpleMesh LoadMeshFromObj(const char* a_fileName, bool verbose)
   assert(check_is_valid(mesh, true));
   return mesh;
 }
+// Memory mapped OBJ parser.
+// The file is split into one line-aligned range per thread. Pass 1 counts v/vt/vn lines and collects
+// material names per range, pass 2 parses attributes straight to their final offsets and face corners
+// with resolved (also relative) indices, pass 3 triangulates. Corners are then deduplicated through a
+// flat open-addressing table and the SoA arrays of SimpleMesh are filled in parallel.
+// Triangles, quads (split along the shorter diagonal) and material ids (index of the usemtl name
+// among the newmtl entries of the mtllib files, else 0) match tinyobj; larger polygons are fanned,
+// which assumes they are convex, where tinyobj ear-clips them.
+
+struct ObjCorner
+{
+  int v, vt, vn; // 0-based, -1 if absent
+};
+
+struct ObjRange
+{
+  const char *begin = nullptr;
+  const char *end = nullptr;
+  size_t v_count = 0, vt_count = 0, vn_count = 0;
+  size_t v_base = 0, vt_base = 0, vn_base = 0;
+  std::vector<std::string> mtllibs;
+  std::string last_usemtl;
+  bool has_usemtl = false;
+  int start_material = -1;
+  std::vector<ObjCorner> corners;
+  std::vector<uint32_t> face_sizes;
+  std::vector<int> face_materials;
+  std::vector<ObjCorner> tri_corners;
+  std::vector<int> tri_materials;
+  bool error = false;
+};
+
+static inline const char *obj_skip_space(const char *p, const char *end)
+{
+  while (p < end && (*p == ' ' || *p == '\t'))
+    ++p;
+  return p;
+}
+
+static inline const char *obj_token_end(const char *p, const char *end)
+{
+  while (p < end && *p != ' ' && *p != '\t' && *p != '\r')
+    ++p;
+  return p;
+}
+
+static inline const char *obj_parse_float(const char *p, const char *end, float &value)
+{
+  p = obj_skip_space(p, end);
+  if (p < end && *p == '+')
+    ++p;
+  auto res = std::from_chars(p, end, value);
+  if (res.ec != std::errc())
+  {
+    value = 0.0f;
+    return obj_token_end(p, end);
+  }
+  return res.ptr;
+}
+
+static inline const char *obj_parse_int(const char *p, const char *end, int &value)
+{
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+'))
+    negative = *p++ == '-';
+  int v = 0;
+  while (p < end && *p >= '0' && *p <= '9')
+    v = v * 10 + (*p++ - '0');
+  value = negative ? -v : v;
+  return p;
+}
+
+// 1-based or negative (relative to count) OBJ index to 0-based, -1 if absent or invalid;
+// count is the number of elements of that kind defined so far
+static inline int obj_resolve(int index, size_t count)
+{
+  if (index > 0)
+    return size_t(index) <= count ? index - 1 : -1;
+  if (index < 0 && size_t(-index) <= count)
+    return int(count) + index;
+  return -1;
+}
+
+static inline bool obj_keyword(const char *p, const char *end, const char *word, size_t len)
+{
+  return size_t(end - p) > len && memcmp(p, word, len) == 0 && (p[len] == ' ' || p[len] == '\t');
+}
+
+template <typename LineFn>
+static void obj_for_each_line(const ObjRange &range, LineFn fn)
+{
+  const char *p = range.begin;
+  while (p < range.end)
+  {
+    const char *line_end = static_cast<const char *>(memchr(p, '\n', range.end - p));
+    if (!line_end)
+      line_end = range.end;
+    const char *q = obj_skip_space(p, line_end);
+    if (q < line_end && *q != '#')
+      fn(q, line_end);
+    p = line_end + 1;
+  }
+}
+
+static void obj_count(ObjRange &range)
+{
+  obj_for_each_line(range, [&](const char *p, const char *end) {
+    if (obj_keyword(p, end, "v", 1))
+      range.v_count++;
+    else if (obj_keyword(p, end, "vt", 2))
+      range.vt_count++;
+    else if (obj_keyword(p, end, "vn", 2))
+      range.vn_count++;
+    else if (obj_keyword(p, end, "usemtl", 6))
+    {
+      const char *name = obj_skip_space(p + 6, end);
+      range.last_usemtl.assign(name, obj_token_end(name, end));
+      range.has_usemtl = true;
+    }
+    else if (obj_keyword(p, end, "mtllib", 6))
+    {
+      const char *name = obj_skip_space(p + 6, end);
+      while (name < end && *name != '\r')
+      {
+        const char *name_end = obj_token_end(name, end);
+        range.mtllibs.emplace_back(name, name_end);
+        name = obj_skip_space(name_end, end);
+      }
+    }
+  });
+}
+
+static void obj_parse(ObjRange &range, const std::unordered_map<std::string, int> &materials,
+                      float *positions, float *texcoords, float *normals)
+{
+  size_t v = range.v_base, vt = range.vt_base, vn = range.vn_base;
+  int material = range.start_material;
+  obj_for_each_line(range, [&](const char *p, const char *end) {
+    if (obj_keyword(p, end, "v", 1))
+    {
+      p += 1;
+      for (int k = 0; k < 3; ++k)
+        p = obj_parse_float(p, end, positions[3 * v + k]);
+      v++;
+    }
+    else if (obj_keyword(p, end, "vt", 2))
+    {
+      p += 2;
+      for (int k = 0; k < 2; ++k)
+        p = obj_parse_float(p, end, texcoords[2 * vt + k]);
+      vt++;
+    }
+    else if (obj_keyword(p, end, "vn", 2))
+    {
+      p += 2;
+      for (int k = 0; k < 3; ++k)
+        p = obj_parse_float(p, end, normals[3 * vn + k]);
+      vn++;
+    }
+    else if (obj_keyword(p, end, "f", 1))
+    {
+      p = obj_skip_space(p + 1, end);
+      uint32_t count = 0;
+      while (p < end && *p != '\r')
+      {
+        int iv = 0, ivt = 0, ivn = 0;
+        p = obj_parse_int(p, end, iv);
+        if (p < end && *p == '/')
+        {
+          if (++p < end && *p != '/')
+            p = obj_parse_int(p, end, ivt);
+          if (p < end && *p == '/')
+            p = obj_parse_int(p + 1, end, ivn);
+        }
+        ObjCorner c = {obj_resolve(iv, v), obj_resolve(ivt, vt), obj_resolve(ivn, vn)};
+        // vt and vn may be absent (0), but an index that was given has to exist
+        if (c.v < 0 || (ivt != 0 && c.vt < 0) || (ivn != 0 && c.vn < 0))
+        {
+          range.error = true;
+          return;
+        }
+        range.corners.push_back(c);
+        count++;
+        p = obj_skip_space(obj_token_end(p, end), end);
+      }
+      if (count < 3)
+      {
+        range.corners.resize(range.corners.size() - count);
+        return;
+      }
+      range.face_sizes.push_back(count);
+      range.face_materials.push_back(material);
+    }
+    else if (obj_keyword(p, end, "usemtl", 6))
+    {
+      const char *name = obj_skip_space(p + 6, end);
+      auto it = materials.find(std::string(name, obj_token_end(name, end)));
+      material = it != materials.end() ? it->second : -1;
+    }
+  });
+}
+
+static void obj_triangulate(ObjRange &range, const float *positions)
+{
+  size_t first = 0;
+  for (size_t f = 0; f < range.face_sizes.size(); ++f)
+  {
+    const ObjCorner *c = range.corners.data() + first;
+    uint32_t n = range.face_sizes[f];
+    first += n;
+    if (n == 4)
+    {
+      auto sqr_dist = [&](int a, int b) {
+        float d = 0.0f;
+        for (int k = 0; k < 3; ++k)
+        {
+          float e = positions[3 * c[b].v + k] - positions[3 * c[a].v + k];
+          d += e * e;
+        }
+        return d;
+      };
+      static const int split02[6] = {0, 1, 2, 0, 2, 3};
+      static const int split13[6] = {0, 1, 3, 1, 2, 3};
+      const int *order = sqr_dist(0, 2) < sqr_dist(1, 3) ? split02 : split13;
+      for (int k = 0; k < 6; ++k)
+        range.tri_corners.push_back(c[order[k]]);
+      range.tri_materials.push_back(range.face_materials[f]);
+      range.tri_materials.push_back(range.face_materials[f]);
+      continue;
+    }
+    for (uint32_t k = 1; k + 1 < n; ++k)
+    {
+      range.tri_corners.push_back(c[0]);
+      range.tri_corners.push_back(c[k]);
+      range.tri_corners.push_back(c[k + 1]);
+      range.tri_materials.push_back(range.face_materials[f]);
+    }
+  }
+}
+
+static inline uint64_t mix64(uint64_t x)
+{
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ull;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebull;
+  x ^= x >> 31;
+  return x;
+}
+
+// Flat open-addressing (linear probing) map from a (v, vt, vn) corner to its output vertex
+struct CornerTable
+{
+  struct Slot
+  {
+    ObjCorner key;
+    uint32_t value;
+  };
+  static const uint32_t EMPTY_SLOT = 0xFFFFFFFFu;
+  std::vector<Slot> slots;
+  size_t mask = 0;
+  size_t size = 0;
+
+  // expected_entries only sets the initial capacity, the table doubles at half load
+  explicit CornerTable(size_t expected_entries)
+  {
+    size_t capacity = 16;
+    while (capacity < 2 * expected_entries)
+      capacity *= 2;
+    slots.assign(capacity, Slot{{0, 0, 0}, EMPTY_SLOT});
+    mask = capacity - 1;
+  }
+
+  void grow()
+  {
+    std::vector<Slot> old(2 * slots.size(), Slot{{0, 0, 0}, EMPTY_SLOT});
+    old.swap(slots);
+    mask = slots.size() - 1;
+    for (const Slot &s : old)
+    {
+      if (s.value == EMPTY_SLOT)
+        continue;
+      size_t i = hash(s.key) & mask;
+      while (slots[i].value != EMPTY_SLOT)
+        i = (i + 1) & mask;
+      slots[i] = s;
+    }
+  }
+
+  static uint64_t hash(const ObjCorner &c)
+  {
+    return mix64((uint64_t(uint32_t(c.v)) << 32 | uint32_t(c.vt)) ^ mix64(uint64_t(uint32_t(c.vn)) + 0x9e3779b97f4a7c15ull));
+  }
+
+  // existing vertex of c, or next_value (and inserted = true)
+  uint32_t insert(const ObjCorner &c, uint32_t next_value, bool &inserted)
+  {
+    if (2 * (size + 1) > slots.size())
+      grow();
+    size_t i = hash(c) & mask;
+    while (true)
+    {
+      Slot &s = slots[i];
+      if (s.value == EMPTY_SLOT)
+      {
+        s.key = c;
+        s.value = next_value;
+        size++;
+        inserted = true;
+        return next_value;
+      }
+      if (s.key.v == c.v && s.key.vt == c.vt && s.key.vn == c.vn)
+      {
+        inserted = false;
+        return s.value;
+      }
+      i = (i + 1) & mask;
+    }
+  }
+};
+
+static std::string obj_directory(const char *path)
+{
+  std::string dir(path);
+  size_t slash = dir.find_last_of("/\\");
+  return slash == std::string::npos ? std::string() : dir.substr(0, slash + 1);
+}
+
+// newmtl names of the mtllib files in declaration order, as tinyobj numbers them
+static void obj_load_materials(const std::vector<std::string> &mtllibs, const std::string &dir,
+                               std::unordered_map<std::string, int> &materials)
+{
+  for (const std::string &lib : mtllibs)
+  {
+    std::ifstream in(dir + lib);
+    if (!in)
+      in.open(lib);
+    if (!in)
+      continue;
+    std::string line;
+    while (std::getline(in, line))
+    {
+      size_t p = line.find_first_not_of(" \t");
+      if (p == std::string::npos || line.compare(p, 7, "newmtl ") != 0)
+        continue;
+      size_t b = line.find_first_not_of(" \t", p + 7);
+      size_t e = line.find_last_not_of(" \t\r");
+      if (b != std::string::npos && e >= b)
+        materials.emplace(line.substr(b, e - b + 1), (int)materials.size());
+    }
+  }
+}
+
+static bool LoadMeshFromObjMapped(const char* a_fileName, bool verbose, SimpleMesh &mesh)
+{
+  MappedFile file;
+  if (!file.open(a_fileName))
+    return false;
+  const char *data = reinterpret_cast<const char *>(file.data);
+  const char *data_end = data + file.size;
+
+  int threads = 1;
+  #ifdef _OPENMP
+  threads = omp_get_max_threads();
+  #endif
+  int range_count = (int)std::max<size_t>(1, std::min<size_t>(4 * threads, file.size / (1 << 16) + 1));
+  std::vector<ObjRange> ranges(range_count);
+  const char *p = data;
+  for (int r = 0; r < range_count; ++r)
+  {
+    const char *end = r + 1 == range_count ? data_end : std::max(p, data + file.size * (r + 1) / range_count);
+    const char *nl = end < data_end ? static_cast<const char *>(memchr(end, '\n', data_end - end)) : nullptr;
+    end = r + 1 == range_count || !nl ? data_end : nl + 1;
+    ranges[r].begin = p;
+    ranges[r].end = end;
+    p = end;
+  }
+
+  #pragma omp parallel for schedule(dynamic)
+  for (int r = 0; r < range_count; ++r)
+    obj_count(ranges[r]);
+
+  size_t v_total = 0, vt_total = 0, vn_total = 0;
+  std::vector<std::string> mtllibs;
+  for (ObjRange &range : ranges)
+  {
+    range.v_base = v_total;
+    range.vt_base = vt_total;
+    range.vn_base = vn_total;
+    v_total += range.v_count;
+    vt_total += range.vt_count;
+    vn_total += range.vn_count;
+    mtllibs.insert(mtllibs.end(), range.mtllibs.begin(), range.mtllibs.end());
+  }
+  std::unordered_map<std::string, int> materials;
+  obj_load_materials(mtllibs, obj_directory(a_fileName), materials);
+  int material = -1;
+  for (ObjRange &range : ranges)
+  {
+    range.start_material = material;
+    if (range.has_usemtl)
+    {
+      auto it = materials.find(range.last_usemtl);
+      material = it != materials.end() ? it->second : -1;
+    }
+  }
+
+  std::vector<float> positions(3 * v_total), texcoords(2 * vt_total), normals(3 * vn_total);
+  #pragma omp parallel for schedule(dynamic)
+  for (int r = 0; r < range_count; ++r)
+  {
+    obj_parse(ranges[r], materials, positions.data(), texcoords.data(), normals.data());
+    if (!ranges[r].error)
+      obj_triangulate(ranges[r], positions.data());
+  }
+
+  size_t tri_total = 0;
+  for (const ObjRange &range : ranges)
+  {
+    if (range.error)
+    {
+      printf("[LoadMeshFromObj::ERROR] Face with invalid vertex index in %s\n", a_fileName);
+      return false;
+    }
+    tri_total += range.tri_materials.size();
+  }
+
+  // dedup in file order, so vertices are numbered by first use like the tinyobj path
+  // most corners share their position index with others, so the position count is a fair first guess
+  CornerTable table(v_total);
+  std::vector<ObjCorner> unique;
+  unique.reserve(v_total);
+  mesh.indices.resize(3 * tri_total);
+  mesh.matIndices.resize(tri_total);
+  size_t tri = 0;
+  for (const ObjRange &range : ranges)
+  {
+    for (size_t i = 0; i < range.tri_corners.size(); ++i)
+    {
+      bool inserted;
+      uint32_t index = table.insert(range.tri_corners[i], (uint32_t)unique.size(), inserted);
+      if (inserted)
+        unique.push_back(range.tri_corners[i]);
+      mesh.indices[3 * tri + i] = index;
+    }
+    for (size_t t = 0; t < range.tri_materials.size(); ++t)
+      mesh.matIndices[tri + t] = range.tri_materials[t] < 0 ? 0 : range.tri_materials[t];
+    tri += range.tri_materials.size();
+  }
+
+  size_t vert_count = unique.size();
+  mesh.vPos4f.resize(vert_count);
+  mesh.vNorm4f.resize(vert_count);
+  mesh.vTang4f.resize(vert_count);
+  mesh.vTexCoord2f.resize(vert_count);
+  #pragma omp parallel for
+  for (long long i = 0; i < (long long)vert_count; ++i)
+  {
+    const ObjCorner &c = unique[i];
+    mesh.vPos4f[i] = float4(positions[3 * c.v], positions[3 * c.v + 1], positions[3 * c.v + 2], 1.0f);
+    mesh.vNorm4f[i] = c.vn >= 0 ? float4(normals[3 * c.vn], normals[3 * c.vn + 1], normals[3 * c.vn + 2], 0.0f) : float4(0, 0, 1, 0);
+    mesh.vTang4f[i] = float4(1, 0, 0, 0);
+    mesh.vTexCoord2f[i] = c.vt >= 0 ? float2(texcoords[2 * c.vt], texcoords[2 * c.vt + 1]) : float2(0, 0);
+  }
+
+  if (verbose)
+  {
+    printf("[LoadMeshFromObj::INFO] Loaded obj file %s with %d vertices and %d indices\n",
+           a_fileName, (unsigned)mesh.vPos4f.size(), (unsigned)mesh.indices.size());
+  }
+  return true;
+}
+
+static SimpleMesh LoadMeshFromObjParsed(const char* a_fileName, bool verbose)
+{
+  if (verbose)
+    printf("[LoadMesh::INFO] Loading OBJ file %s\n", a_fileName);
+  SimpleMesh mesh;
+  if (!LoadMeshFromObjMapped(a_fileName, verbose, mesh))
+  {
+    printf("[LoadMeshFromObj::ERROR] Failed to load obj file: %s\n", a_fileName);
+    return SimpleMesh();
+  }
+  fix_missing(mesh, 0);
+  assert(check_is_valid(mesh, true));
+  return mesh;
+}
+
+SimpleMeshView::SimpleMeshView(const SimpleMesh &mesh)
+  : vPos4f(mesh.vPos4f.data()), vNorm4f(mesh.vNorm4f.data()), vTang4f(mesh.vTang4f.data()),
+    vTexCoord2f(mesh.vTexCoord2f.data()), indices(mesh.indices.data()), matIndices(mesh.matIndices.data()),
+    vertNum(mesh.VerticesNum()), indNum(mesh.IndicesNum())
+{
+}
+
+SimpleMesh MappedMesh::ToMesh() const
+{
+  SimpleMesh mesh;
+  mesh.vPos4f.assign(view.vPos4f, view.vPos4f + view.vertNum);
+  mesh.vNorm4f.assign(view.vNorm4f, view.vNorm4f + view.vertNum);
+  mesh.vTang4f.assign(view.vTang4f, view.vTang4f + view.vertNum);
+  mesh.vTexCoord2f.assign(view.vTexCoord2f, view.vTexCoord2f + view.vertNum);
+  mesh.indices.assign(view.indices, view.indices + view.indNum);
+  mesh.matIndices.assign(view.matIndices, view.matIndices + view.indNum / 3);
+  return mesh;
+}
+
+static const char MESH_FILE_MAGIC[8] = {'C', 'M', 'E', 'S', 'H', '4', 'B', 0};
+static const uint32_t MESH_FILE_VERSION = 1;
+static const uint64_t MESH_FILE_ALIGN = 64;
+
+enum MeshFileArray
+{
+  MESH_ARRAY_POS,
+  MESH_ARRAY_NORM,
+  MESH_ARRAY_TANG,
+  MESH_ARRAY_TEXCOORD,
+  MESH_ARRAY_INDICES,
+  MESH_ARRAY_MAT_INDICES,
+  MESH_ARRAY_COUNT
+};
+
+struct MeshFileHeader
+{
+  char     magic[8];
+  uint32_t version;
+  uint32_t headerSize;
+  uint64_t sourceHash;
+  uint64_t vertNum;
+  uint64_t indNum;
+  uint64_t fileSize;
+  uint64_t offset[MESH_ARRAY_COUNT];
+};
+static_assert(sizeof(MeshFileHeader) <= 128, "mesh file header must fit in 128 bytes");
+
+static uint64_t align_up(uint64_t value, uint64_t alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+static void mesh_file_array_bytes(uint64_t vertNum, uint64_t indNum, uint64_t bytes[MESH_ARRAY_COUNT])
+{
+  bytes[MESH_ARRAY_POS] = vertNum * sizeof(float4);
+  bytes[MESH_ARRAY_NORM] = vertNum * sizeof(float4);
+  bytes[MESH_ARRAY_TANG] = vertNum * sizeof(float4);
+  bytes[MESH_ARRAY_TEXCOORD] = vertNum * sizeof(float2);
+  bytes[MESH_ARRAY_INDICES] = indNum * sizeof(unsigned int);
+  bytes[MESH_ARRAY_MAT_INDICES] = indNum / 3 * sizeof(unsigned int);
+}
+
+bool SaveMeshToBinary(const char* a_fileName, const SimpleMesh &mesh, uint64_t sourceHash)
+{
+  const void *data[MESH_ARRAY_COUNT] = {mesh.vPos4f.data(), mesh.vNorm4f.data(), mesh.vTang4f.data(),
+                                        mesh.vTexCoord2f.data(), mesh.indices.data(), mesh.matIndices.data()};
+  MeshFileHeader header = {};
+  memcpy(header.magic, MESH_FILE_MAGIC, sizeof(header.magic));
+  header.version = MESH_FILE_VERSION;
+  header.headerSize = 128;
+  header.sourceHash = sourceHash;
+  header.vertNum = mesh.VerticesNum();
+  header.indNum = mesh.IndicesNum();
+  assert(mesh.vNorm4f.size() == header.vertNum && mesh.vTang4f.size() == header.vertNum &&
+         mesh.vTexCoord2f.size() == header.vertNum && 3 * mesh.matIndices.size() == header.indNum);
+  uint64_t bytes[MESH_ARRAY_COUNT];
+  mesh_file_array_bytes(header.vertNum, header.indNum, bytes);
+  uint64_t offset = header.headerSize;
+  for (int a = 0; a < MESH_ARRAY_COUNT; ++a)
+  {
+    header.offset[a] = offset;
+    offset = align_up(offset + bytes[a], MESH_FILE_ALIGN);
+  }
+  header.fileSize = offset;
+
+  // written under a temporary name and renamed, so readers never map a partial file
+  std::string tmp = std::string(a_fileName) + ".tmp";
+  FILE *out = fopen(tmp.c_str(), "wb");
+  if (!out)
+  {
+    printf("[SaveMeshToBinary::ERROR] Failed to create output file: %s\n", tmp.c_str());
+    return false;
+  }
+  static const char zeros[128] = {};
+  bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+            fwrite(zeros, 1, header.headerSize - sizeof(header), out) == header.headerSize - sizeof(header);
+  uint64_t written = header.headerSize;
+  for (int a = 0; a < MESH_ARRAY_COUNT && ok; ++a)
+  {
+    ok = bytes[a] == 0 || fwrite(data[a], 1, bytes[a], out) == bytes[a];
+    written += bytes[a];
+    uint64_t pad = (a + 1 < MESH_ARRAY_COUNT ? header.offset[a + 1] : header.fileSize) - written;
+    ok = ok && fwrite(zeros, 1, pad, out) == pad;
+    written += pad;
+  }
+  ok = fclose(out) == 0 && ok;
+  if (ok)
+  {
+    remove(a_fileName);
+    ok = rename(tmp.c_str(), a_fileName) == 0;
+  }
+  if (!ok)
+  {
+    remove(tmp.c_str());
+    printf("[SaveMeshToBinary::ERROR] Failed to write output file: %s\n", a_fileName);
+  }
+  return ok;
+}
+
+bool LoadMeshFromBinary(const char* a_fileName, MappedMesh &out, uint64_t expectedHash)
+{
+  MappedFile file;
+  if (!file.open(a_fileName) || file.size < 128)
+    return false;
+  MeshFileHeader header;
+  memcpy(&header, file.data, sizeof(header));
+  if (memcmp(header.magic, MESH_FILE_MAGIC, sizeof(header.magic)) != 0 || header.version != MESH_FILE_VERSION ||
+      header.fileSize != file.size || (expectedHash != 0 && header.sourceHash != expectedHash))
+    return false;
+
+  uint64_t bytes[MESH_ARRAY_COUNT];
+  mesh_file_array_bytes(header.vertNum, header.indNum, bytes);
+  for (int a = 0; a < MESH_ARRAY_COUNT; ++a)
+  {
+    if (header.indNum % 3 != 0 || header.vertNum > file.size || header.indNum > file.size ||
+        header.offset[a] % MESH_FILE_ALIGN != 0 || header.offset[a] > file.size || bytes[a] > file.size - header.offset[a])
+    {
+      printf("[LoadMeshFromBinary::ERROR] Corrupted mesh file: %s\n", a_fileName);
+      return false;
+    }
+  }
+
+  out.owned = SimpleMesh();
+  out.view.vPos4f      = reinterpret_cast<const float4 *>(file.data + header.offset[MESH_ARRAY_POS]);
+  out.view.vNorm4f     = reinterpret_cast<const float4 *>(file.data + header.offset[MESH_ARRAY_NORM]);
+  out.view.vTang4f     = reinterpret_cast<const float4 *>(file.data + header.offset[MESH_ARRAY_TANG]);
+  out.view.vTexCoord2f = reinterpret_cast<const float2 *>(file.data + header.offset[MESH_ARRAY_TEXCOORD]);
+  out.view.indices     = reinterpret_cast<const unsigned int *>(file.data + header.offset[MESH_ARRAY_INDICES]);
+  out.view.matIndices  = reinterpret_cast<const unsigned int *>(file.data + header.offset[MESH_ARRAY_MAT_INDICES]);
+  out.view.vertNum = header.vertNum;
+  out.view.indNum = header.indNum;
+  out.file = std::move(file);
+  return true;
+}
+
+// 64-bit hash of the file contents; 1 MB blocks are hashed in parallel and combined in order
+uint64_t HashFileContents(const char* a_fileName)
+{
+  MappedFile file;
+  if (!file.open(a_fileName))
+    return 0;
+  const size_t BLOCK = 1 << 20;
+  size_t blocks = (file.size + BLOCK - 1) / BLOCK;
+  std::vector<uint64_t> block_hash(blocks);
+  #pragma omp parallel for schedule(dynamic)
+  for (long long b = 0; b < (long long)blocks; ++b)
+  {
+    const uint8_t *p = file.data + b * BLOCK;
+    size_t n = std::min<size_t>(BLOCK, file.size - b * BLOCK);
+    uint64_t h[4] = {0x243f6a8885a308d3ull, 0x13198a2e03707344ull, 0xa4093822299f31d0ull, 0x082efa98ec4e6c89ull};
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+      for (int k = 0; k < 4; ++k)
+      {
+        uint64_t word;
+        memcpy(&word, p + i + 8 * k, 8);
+        h[k] = (h[k] ^ word) * 0x9e3779b97f4a7c15ull;
+        h[k] ^= h[k] >> 29;
+      }
+    }
+    // the last 0..31 bytes are zero padded to a full 32-byte step, so every byte reaches the hash
+    if (i < n)
+    {
+      uint8_t tail[32] = {};
+      memcpy(tail, p + i, n - i);
+      for (int k = 0; k < 4; ++k)
+      {
+        uint64_t word;
+        memcpy(&word, tail + 8 * k, 8);
+        h[k] = (h[k] ^ word) * 0x9e3779b97f4a7c15ull;
+        h[k] ^= h[k] >> 29;
+      }
+    }
+    block_hash[b] = mix64(h[0] ^ mix64(h[1] ^ mix64(h[2] ^ mix64(h[3] ^ n))));
+  }
+  uint64_t hash = mix64(file.size);
+  for (uint64_t bh : block_hash)
+    hash = mix64(hash ^ bh);
+  return hash == 0 ? 1 : hash;
+}
+
+bool LoadMeshFromObjCached(const char* a_fileName, MappedMesh &out, bool verbose)
+{
+  uint64_t hash = HashFileContents(a_fileName);
+  if (hash == 0)
+  {
+    printf("[LoadMeshFromObj::ERROR] Failed to open obj file: %s\n", a_fileName);
+    return false;
+  }
+  std::string cache = std::string(a_fileName) + ".meshbin";
+  if (LoadMeshFromBinary(cache.c_str(), out, hash))
+  {
+    if (verbose)
+      printf("[LoadMeshFromObj::INFO] Mapped cached mesh %s\n", cache.c_str());
+    return true;
+  }
+
+  SimpleMesh mesh = LoadMeshFromObjParsed(a_fileName, verbose);
+  if (mesh.VerticesNum() == 0)
+    return false;
+  if (SaveMeshToBinary(cache.c_str(), mesh, hash) && LoadMeshFromBinary(cache.c_str(), out, hash))
+    return true;
+
+  // cache directory is not writable, keep the parsed mesh
+  out.file.close();
+  out.owned = std::move(mesh);
+  out.view = SimpleMeshView(out.owned);
+  return true;
+}
+
+SimpleMesh LoadMeshFromObj(const char* a_fileName, bool verbose, bool use_tinyobj)
+{
+  if (use_tinyobj)
+    return LoadMeshFromObjTinyObj(a_fileName, verbose);
+
+  MappedMesh mapped;
+  if (!LoadMeshFromObjCached(a_fileName, mapped, verbose))
+    return SimpleMesh();
+  if (!mapped.file.data)
+    return std::move(mapped.owned);
+  return mapped.ToMesh();
+}
 } // namespace cmesh4
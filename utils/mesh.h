@@ -2,8 +2,10 @@
 
 #include <vector>
 #include <cassert>
+#include <cstdint>
 
 #include "LiteMath.h"
+#include "mapped_file.h"
 
 namespace cmesh4
 {
@@ -53,6 +55,49 @@ namespace cmesh4
     std::vector<unsigned int>     matIndices;  // size = 1*TrianglesNum()
   };
 
+  // non-owning view of the arrays of a SimpleMesh, e.g. inside a memory mapped binary mesh
+  struct SimpleMeshView
+  {
+    const LiteMath::float4 *vPos4f      = nullptr;
+    const LiteMath::float4 *vNorm4f     = nullptr;
+    const LiteMath::float4 *vTang4f     = nullptr;
+    const LiteMath::float2 *vTexCoord2f = nullptr;
+    const unsigned int     *indices     = nullptr;
+    const unsigned int     *matIndices  = nullptr;
+    size_t vertNum = 0;
+    size_t indNum  = 0;
+
+    SimpleMeshView() {}
+    explicit SimpleMeshView(const SimpleMesh &mesh);
+
+    inline size_t VerticesNum()  const { return vertNum; }
+    inline size_t IndicesNum()   const { return indNum;  }
+    inline size_t TrianglesNum() const { return indNum / SimpleMesh::POINTS_IN_TRIANGLE; }
+  };
+
+  // Mesh whose view points into a mapped binary mesh file (or into owned when it could not be mapped)
+  struct MappedMesh
+  {
+    MappedFile file;
+    SimpleMesh owned;
+    SimpleMeshView view;
+
+    SimpleMesh ToMesh() const;
+  };
+
   void SaveMeshToObj(const char* a_fileName, const cmesh4::SimpleMesh &mesh);
-  SimpleMesh LoadMeshFromObj(const char* a_fileName, bool verbose = false);
+
+  // Binary mesh: 128 byte header followed by the raw arrays, each aligned to 64 bytes.
+  // sourceHash identifies the data the mesh was built from; LoadMeshFromBinary rejects a file whose
+  // hash differs from a non-zero expectedHash.
+  bool SaveMeshToBinary(const char* a_fileName, const SimpleMesh &mesh, uint64_t sourceHash = 0);
+  bool LoadMeshFromBinary(const char* a_fileName, MappedMesh &out, uint64_t expectedHash = 0);
+  uint64_t HashFileContents(const char* a_fileName);
+
+  // OBJ import through a "<file>.meshbin" cache next to it, keyed by the OBJ content hash: the cache
+  // is mapped when it is current and (re)written after a parse otherwise.
+  bool LoadMeshFromObjCached(const char* a_fileName, MappedMesh &out, bool verbose = false);
+  // Goes through LoadMeshFromObjCached (the OBJ is parsed in parallel from a memory mapping when the
+  // cache is stale); use_tinyobj selects the tinyobj based loader without a cache.
+  SimpleMesh LoadMeshFromObj(const char* a_fileName, bool verbose = false, bool use_tinyobj = false);
 };
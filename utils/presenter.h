@@ -0,0 +1,158 @@
+#pragma once
+#include <SDL.h>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "profiler.h"
+
+// Double-buffered presentation with the pixel copy on a worker thread.
+// The frame thread traces into back_buffer() and hands it over with submit(). SDL only supports
+// rendering on the thread that created the window, so every SDL call (renderer, texture lock, present)
+// stays on the frame thread; the worker only copies the submitted buffer into the locked streaming
+// texture, which overlaps with tracing the next frame into the other buffer. A frame is presented by
+// the submit() after it (or by flush()), which first waits for its copy to finish.
+struct FramePresenter {
+    SDL_Window *window = nullptr;
+    SDL_Renderer *renderer = nullptr;
+    SDL_Texture *texture = nullptr;
+    int width = 0;
+    int height = 0;
+
+    std::vector<uint32_t> buffers[2];
+    int back = 0;               // buffer owned by the frame thread
+    int pending = -1;           // buffer waiting to be copied, -1 if none
+    bool copying = false;
+    bool staged = false;        // the locked texture holds a frame that was not presented yet
+    bool running = false;
+    void *pixels = nullptr;     // locked texture memory, written only by the worker
+    int pitch = 0;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::thread thread;
+
+    bool start(SDL_Window *window1, int w, int h) {
+        window = window1;
+        width = w;
+        height = h;
+        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+        if (!renderer) {
+            printf("[FramePresenter::ERROR] Renderer could not be created! SDL_Error: %s\n", SDL_GetError());
+            return false;
+        }
+        texture = SDL_CreateTexture(
+            renderer,
+            SDL_PIXELFORMAT_ARGB8888,    // 32-bit RGBA format
+            SDL_TEXTUREACCESS_STREAMING, // Allows us to update the texture
+            width,
+            height);
+        if (!texture) {
+            printf("[FramePresenter::ERROR] Texture could not be created! SDL_Error: %s\n", SDL_GetError());
+            SDL_DestroyRenderer(renderer);
+            renderer = nullptr;
+            return false;
+        }
+        for (int i = 0; i < 2; ++i) {
+            buffers[i].assign(w * h, 0xFFFFFFFF);
+        }
+        running = true;
+        thread = std::thread([this]() { run(); });
+        return true;
+    }
+
+    uint32_t *back_buffer() { return buffers[back].data(); }
+
+    // Waits for the copy of the last submitted frame; frame thread only
+    void wait_copy() {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this]() { return pending == -1 && !copying; });
+    }
+
+    // Presents the last submitted frame if it was not presented yet; frame thread only
+    void flush() {
+        wait_copy();
+        if (!staged) {
+            return;
+        }
+        PROFILE_SCOPE(STAGE_PRESENT);
+        SDL_UnlockTexture(texture);
+        pixels = nullptr;
+        staged = false;
+        SDL_RenderClear(renderer);
+        SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+        SDL_RenderPresent(renderer);
+    }
+
+    // Presents the previous frame, hands the back buffer to the worker for copying and returns the
+    // other buffer for the next frame.
+    uint32_t *submit() {
+        flush();
+        if (SDL_LockTexture(texture, nullptr, &pixels, &pitch) != 0) {
+            printf("[FramePresenter::ERROR] Texture could not be locked! SDL_Error: %s\n", SDL_GetError());
+            return buffers[back].data();
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending = back;
+            staged = true;
+            back ^= 1;
+        }
+        cv.notify_all();
+        return buffers[back].data();
+    }
+
+    void stop() {
+        if (!running) {
+            return;
+        }
+        flush();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        cv.notify_all();
+        thread.join();
+        SDL_DestroyTexture(texture);
+        SDL_DestroyRenderer(renderer);
+    }
+
+    void run() {
+        for (;;) {
+            int cur;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [this]() { return pending != -1 || !running; });
+                if (pending == -1) {
+                    break;
+                }
+                cur = pending;
+                pending = -1;
+                copying = true;
+            }
+
+            {
+                PROFILE_SCOPE(STAGE_UPLOAD);
+                const uint32_t *src = buffers[cur].data();
+                uint8_t *dst = (uint8_t *)pixels;
+                if (pitch == width * (int)sizeof(uint32_t)) {
+                    memcpy(dst, src, (size_t)width * height * sizeof(uint32_t));
+                } else {
+                    for (int y = 0; y < height; ++y) {
+                        memcpy(dst + (size_t)y * pitch, src + (size_t)y * width, width * sizeof(uint32_t));
+                    }
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                copying = false;
+            }
+            cv.notify_all();
+        }
+    }
+};
@@ -0,0 +1,184 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// Frame pipeline stage timers.
+// Timers are recorded into a fixed-size lock-free ring buffer (any thread may push),
+// and exported on demand as CSV or as Chrome trace JSON (chrome://tracing, Perfetto).
+
+enum ProfileStage {
+    STAGE_FRAME,
+    STAGE_INPUT,
+    STAGE_CAMERA,
+    STAGE_RENDER,
+    STAGE_UPSCALE,
+    STAGE_UPLOAD,
+    STAGE_PRESENT,
+    STAGE_SUBMIT_WAIT,
+    STAGE_WORLD_BUILD,
+    STAGE_TEXTURES,
+    STAGE_COUNT
+};
+
+const char *profile_stage_names[STAGE_COUNT] = {
+    "frame",
+    "input",
+    "camera",
+    "render",
+    "upscale",
+    "upload",
+    "present",
+    "submit_wait",
+    "world_build",
+    "textures"
+};
+
+struct ProfileEvent {
+    std::atomic<uint64_t> seq{0}; // index + 1 of the event stored in the slot, 0 if empty
+    uint32_t stage;
+    uint32_t frame;
+    uint32_t thread;
+    int64_t start_ns;
+    int64_t duration_ns;
+};
+
+struct FrameProfiler {
+    static constexpr uint32_t CAPACITY = 1 << 16; // must be a power of two
+
+    std::vector<ProfileEvent> events;
+    std::atomic<uint64_t> head{0};
+    std::atomic<uint32_t> frame{0};
+    std::atomic<bool> enabled{true};
+    std::chrono::steady_clock::time_point epoch;
+
+    FrameProfiler() : events(CAPACITY), epoch(std::chrono::steady_clock::now()) {}
+
+    int64_t now_ns() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    static uint32_t thread_index() {
+        static std::atomic<uint32_t> next_thread{0};
+        thread_local uint32_t index = next_thread.fetch_add(1, std::memory_order_relaxed);
+        return index;
+    }
+
+    void begin_frame() { frame.fetch_add(1, std::memory_order_relaxed); }
+
+    // Wait-free for producers: claim a slot, fill it, publish it with the sequence number.
+    // When the ring wraps the oldest events are overwritten.
+    void push(ProfileStage stage, int64_t start_ns, int64_t end_ns) {
+        if (!enabled.load(std::memory_order_relaxed)) {
+            return;
+        }
+        uint64_t i = head.fetch_add(1, std::memory_order_relaxed);
+        ProfileEvent &e = events[i & (CAPACITY - 1)];
+        // seqlock writer: the cleared seq must be visible before any of the new fields
+        e.seq.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        e.stage = stage;
+        e.frame = frame.load(std::memory_order_relaxed);
+        e.thread = thread_index();
+        e.start_ns = start_ns;
+        e.duration_ns = end_ns - start_ns;
+        e.seq.store(i + 1, std::memory_order_release);
+    }
+
+    struct Record {
+        uint32_t stage, frame, thread;
+        int64_t start_ns, duration_ns;
+    };
+
+    // Copies the events that are still in the ring, oldest first.
+    // Slots that are being rewritten during the copy are skipped.
+    std::vector<Record> snapshot() const {
+        std::vector<Record> out;
+        uint64_t end = head.load(std::memory_order_acquire);
+        uint64_t begin = end > CAPACITY ? end - CAPACITY : 0;
+        out.reserve(end - begin);
+        for (uint64_t i = begin; i < end; ++i) {
+            const ProfileEvent &e = events[i & (CAPACITY - 1)];
+            if (e.seq.load(std::memory_order_acquire) != i + 1) {
+                continue;
+            }
+            Record r = {e.stage, e.frame, e.thread, e.start_ns, e.duration_ns};
+            // keeps the field reads above from moving past the re-check
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (e.seq.load(std::memory_order_relaxed) == i + 1) {
+                out.push_back(r);
+            }
+        }
+        return out;
+    }
+
+    bool export_csv(const char *path) const {
+        FILE *out = fopen(path, "w");
+        if (!out) {
+            printf("[FrameProfiler::ERROR] Failed to create output file: %s\n", path);
+            return false;
+        }
+        fprintf(out, "frame,stage,thread,start_ms,duration_ms\n");
+        for (const Record &r : snapshot()) {
+            fprintf(out, "%u,%s,%u,%.6f,%.6f\n", r.frame, profile_stage_names[r.stage], r.thread,
+                r.start_ns * 1e-6, r.duration_ns * 1e-6);
+        }
+        fclose(out);
+        return true;
+    }
+
+    bool export_chrome_trace(const char *path) const {
+        FILE *out = fopen(path, "w");
+        if (!out) {
+            printf("[FrameProfiler::ERROR] Failed to create output file: %s\n", path);
+            return false;
+        }
+        fprintf(out, "{\"traceEvents\":[\n");
+        bool first = true;
+        for (const Record &r : snapshot()) {
+            fprintf(out, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%u}}",
+                first ? "" : ",\n", profile_stage_names[r.stage], r.thread, r.start_ns * 1e-3, r.duration_ns * 1e-3, r.frame);
+            first = false;
+        }
+        fprintf(out, "\n],\"displayTimeUnit\":\"ms\"}\n");
+        fclose(out);
+        return true;
+    }
+
+    // Average and worst time per stage over the events still in the ring.
+    void print_summary(FILE *out) const {
+        double total[STAGE_COUNT] = {};
+        double worst[STAGE_COUNT] = {};
+        int count[STAGE_COUNT] = {};
+        for (const Record &r : snapshot()) {
+            double ms = r.duration_ns * 1e-6;
+            total[r.stage] += ms;
+            worst[r.stage] = std::max(worst[r.stage], ms);
+            count[r.stage]++;
+        }
+        fprintf(out, "%-12s %8s %10s %10s\n", "stage", "count", "avg_ms", "max_ms");
+        for (int i = 0; i < STAGE_COUNT; ++i) {
+            if (count[i] == 0) {
+                continue;
+            }
+            fprintf(out, "%-12s %8d %10.3f %10.3f\n", profile_stage_names[i], count[i], total[i] / count[i], worst[i]);
+        }
+    }
+};
+
+FrameProfiler profiler;
+
+struct ScopedTimer {
+    ProfileStage stage;
+    int64_t start_ns;
+
+    explicit ScopedTimer(ProfileStage stage1) : stage(stage1), start_ns(profiler.now_ns()) {}
+    ~ScopedTimer() { profiler.push(stage, start_ns, profiler.now_ns()); }
+};
+
+#define PROFILE_CONCAT_IMPL(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_IMPL(a, b)
+#define PROFILE_SCOPE(stage) ScopedTimer PROFILE_CONCAT(scoped_timer_, __LINE__)(stage)
@@ -0,0 +1,204 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "LiteMath.h"
+
+using LiteMath::float3;
+
+// Progressive accumulation for stills.
+// While the camera stays put every frame adds one path traced sample per pixel to a running sum and
+// the mean is shown. Sample dimensions come from a tileable blue noise mask (void and cluster), offset
+// per dimension and advanced by the golden ratio per sample, so the error is spread as high frequency
+// noise. The per-pixel luminance variance gives the standard error of every pixel's mean; once its
+// average relative to the pixel brightness drops below target_error the image counts as converged
+// and no further samples are traced.
+
+const int BLUE_NOISE_SIZE = 64;
+
+struct BlueNoise {
+    std::vector<float> mask;    // ranks / N, BLUE_NOISE_SIZE^2
+
+    // Void and cluster on a torus with a gaussian energy (sigma 1.5). Energy of all pixels is kept
+    // up to date incrementally, and the largest void is always the empty pixel with the least energy.
+    void generate(uint32_t seed = 1) {
+        const int S = BLUE_NOISE_SIZE, N = S * S;
+        std::vector<float> kernel(N);
+        for (int y = 0; y < S; ++y) {
+            for (int x = 0; x < S; ++x) {
+                int dx = std::min(x, S - x), dy = std::min(y, S - y);
+                kernel[y * S + x] = std::exp(-(dx * dx + dy * dy) / (2.0f * 1.5f * 1.5f));
+            }
+        }
+        std::vector<float> energy(N, 0.0f);
+        std::vector<uint8_t> on(N, 0);
+        auto splat = [&](int p, float sign) {
+            int px = p % S, py = p / S;
+            for (int y = 0; y < S; ++y) {
+                const float *row = &kernel[((y - py + S) % S) * S];
+                for (int x = 0; x < S; ++x) {
+                    energy[y * S + x] += sign * row[(x - px + S) % S];
+                }
+            }
+        };
+        auto extreme = [&](bool value, bool largest) {
+            int best = -1;
+            for (int p = 0; p < N; ++p) {
+                if (on[p] == value && (best < 0 || (largest ? energy[p] > energy[best] : energy[p] < energy[best]))) {
+                    best = p;
+                }
+            }
+            return best;
+        };
+
+        // initial pattern: 10% random points relaxed until the tightest cluster is the largest void
+        uint32_t state = seed;
+        int ones = N / 10;
+        for (int k = 0; k < ones;) {
+            state = state * 1664525u + 1013904223u;
+            int p = (state >> 8) % N;
+            if (!on[p]) {
+                on[p] = 1;
+                splat(p, 1.0f);
+                k++;
+            }
+        }
+        for (int iter = 0; iter < N; ++iter) {
+            int cluster = extreme(true, true);
+            on[cluster] = 0;
+            splat(cluster, -1.0f);
+            int void_p = extreme(false, false);
+            on[void_p] = 1;
+            splat(void_p, 1.0f);
+            if (void_p == cluster) {
+                break;
+            }
+        }
+
+        std::vector<int> rank(N);
+        std::vector<uint8_t> initial = on;
+        std::vector<float> initial_energy = energy;
+        // ranks below the initial count: remove tightest clusters
+        for (int r = ones - 1; r >= 0; --r) {
+            int cluster = extreme(true, true);
+            on[cluster] = 0;
+            splat(cluster, -1.0f);
+            rank[cluster] = r;
+        }
+        // the rest: fill the largest voids
+        on = initial;
+        energy = initial_energy;
+        for (int r = ones; r < N; ++r) {
+            int void_p = extreme(false, false);
+            on[void_p] = 1;
+            splat(void_p, 1.0f);
+            rank[void_p] = r;
+        }
+        mask.resize(N);
+        for (int p = 0; p < N; ++p) {
+            mask[p] = (rank[p] + 0.5f) / N;
+        }
+    }
+
+    // Sample value in [0, 1) of dimension dim for the given sample index at pixel (x, y)
+    float sample(int x, int y, int index, int dim) const {
+        // R2 offsets decorrelate the dimensions, the golden ratio steps through the samples
+        int ox = int(dim * 0.7548776662f * BLUE_NOISE_SIZE) + dim * 7;
+        int oy = int(dim * 0.5698402910f * BLUE_NOISE_SIZE) + dim * 13;
+        float v = mask[((y + oy) & (BLUE_NOISE_SIZE - 1)) * BLUE_NOISE_SIZE + ((x + ox) & (BLUE_NOISE_SIZE - 1))];
+        v += index * 0.6180339887f;
+        return v - std::floor(v);
+    }
+};
+
+struct ProgressiveAccumulator {
+    int width = 0;
+    int height = 0;
+    int samples = 0;
+    std::vector<float3> sum;
+    std::vector<float> lum_sum, lum_sq;   // for the per-pixel variance
+
+    float3 view_pos = float3(1e30f);
+    float3 view_dir = float3(0.0f);
+
+    int min_samples = 16;
+    int max_samples = 4096;
+    float target_error = 0.01f;           // mean relative standard error at which to stop
+    float error = 1.0f;
+    bool converged = false;
+
+    void reset(int w, int h) {
+        width = w;
+        height = h;
+        samples = 0;
+        sum.assign(w * h, float3(0.0f));
+        lum_sum.assign(w * h, 0.0f);
+        lum_sq.assign(w * h, 0.0f);
+        error = 1.0f;
+        converged = false;
+    }
+
+    // Starts over when the image size or the view changed since the last call
+    void begin(int w, int h, float3 pos, float3 dir) {
+        if (w != width || h != height || pos.x != view_pos.x || pos.y != view_pos.y || pos.z != view_pos.z ||
+            dir.x != view_dir.x || dir.y != view_dir.y || dir.z != view_dir.z) {
+            reset(w, h);
+            view_pos = pos;
+            view_dir = dir;
+        }
+    }
+
+    // Adds one sample per pixel, sample(x, y, index) returns the radiance of one path
+    template <class Sample>
+    void add_sample(Sample sample) {
+        if (converged) {
+            return;
+        }
+        const int index = samples;
+        #pragma omp parallel for schedule(dynamic, 4)
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                int i = y * width + x;
+                float3 c = sample(x, y, index);
+                float lum = 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+                sum[i] += c;
+                lum_sum[i] += lum;
+                lum_sq[i] += lum * lum;
+            }
+        }
+        samples++;
+        update_error();
+    }
+
+    void update_error() {
+        if (samples < 2) {
+            return;
+        }
+        double total = 0.0;
+        const float inv_n = 1.0f / samples;
+        #pragma omp parallel for reduction(+:total)
+        for (int i = 0; i < width * height; i++) {
+            float mean = lum_sum[i] * inv_n;
+            float var = std::max(lum_sq[i] * inv_n - mean * mean, 0.0f) * samples / (samples - 1);
+            // dark pixels are judged against a floor so their noise does not dominate
+            total += std::sqrt(var * inv_n) / std::max(mean, 0.05f);
+        }
+        error = float(total / (width * height));
+        converged = (samples >= min_samples && error < target_error) || samples >= max_samples;
+    }
+
+    // Mean colour of every pixel as 0xAARRGGBB
+    void resolve(uint32_t *out) const {
+        const float inv_n = samples > 0 ? 1.0f / samples : 0.0f;
+        #pragma omp parallel for
+        for (int i = 0; i < width * height; i++) {
+            float3 c = sum[i] * inv_n;
+            uint32_t r = (uint32_t)(std::clamp(c.x, 0.0f, 1.0f) * 255.0f);
+            uint32_t g = (uint32_t)(std::clamp(c.y, 0.0f, 1.0f) * 255.0f);
+            uint32_t b = (uint32_t)(std::clamp(c.z, 0.0f, 1.0f) * 255.0f);
+            out[i] = 0xFF000000 | (r << 16) | (g << 8) | b;
+        }
+    }
+};
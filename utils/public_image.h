@@ -6,6 +6,7 @@
 #include <string>
 #include <vector>
 #include <cassert>
+#include <cstdint>
 
 void read_image_rgb(std::string path, std::vector<float> &image_data, int &width, int &height)
 {
@@ -26,9 +27,29 @@ void read_image_rgb(std::string path, std::vector<float> &image_data, int &width
   stbi_image_free(imgData);
 }
 
+// Loads an image as packed 0xAARRGGBB texels (the framebuffer format). Returns false if the file could not be read.
+bool read_image_rgba8(std::string path, std::vector<uint32_t> &image_data, int &width, int &height)
+{
+  int channels;
+  unsigned char *imgData = stbi_load(path.c_str(), &width, &height, &channels, 4);
+  if (!imgData)
+    return false;
+
+  const size_t count = (size_t)width * height;
+  image_data.resize(count);
+  for (size_t i = 0; i < count; i++)
+  {
+    const unsigned char *p = imgData + 4 * i;
+    image_data[i] = (uint32_t(p[3]) << 24) | (uint32_t(p[0]) << 16) | (uint32_t(p[1]) << 8) | uint32_t(p[2]);
+  }
+
+  stbi_image_free(imgData);
+  return true;
+}
+
 void write_image_rgb(std::string path, const std::vector<float> &image_data, int width, int height)
 {
-  assert(3 * width * height == image_data.size());
+  assert((size_t)3 * width * height == image_data.size());
   unsigned char *data = new unsigned char[3 * width * height];
   for (int i = 0; i < 3 * width * height; i++)
     data[i] = std::max(0, std::min(255, (int)(255 * image_data[i])));
@@ -0,0 +1,229 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "LiteMath.h"
+#include "blocks.h"
+#include "voxel_octree.h"
+
+using LiteMath::float2;
+using LiteMath::float3;
+using LiteMath::int3;
+
+// SDF scene graph: primitives combined with CSG operations, voxelised into sparse octree chunks.
+// Every primitive distance is exact or a lower bound and union/intersection/subtraction/smooth union
+// keep that, so |d(p) - d(q)| <= lipschitz * |p - q|. A node whose centre distance exceeds
+// lipschitz * half-diagonal is therefore entirely outside (or inside) and is never subdivided.
+
+enum SdfOp {
+    SDF_SPHERE,       // a = radius
+    SDF_BOX,          // size = half extents
+    SDF_TORUS,        // a = major radius, b = minor radius, ring in the xz plane
+    SDF_CAPSULE,      // segment center..size, a = radius
+    SDF_PLANE,        // size = normal, a = offset, solid below the plane
+    SDF_UNION,
+    SDF_INTERSECTION,
+    SDF_SUBTRACTION,  // left minus right
+    SDF_SMOOTH_UNION  // a = blend radius
+};
+
+struct SdfNode {
+    SdfOp op;
+    float3 center = float3(0.0f);
+    float3 size = float3(0.0f);
+    float a = 0.0f;
+    float b = 0.0f;
+    int block_id = STONE;  // primitives only
+    int left = -1;         // operations only
+    int right = -1;
+};
+
+struct SdfScene {
+    std::vector<SdfNode> nodes;
+    int root = -1;
+    float lipschitz = 1.0f;
+
+    int add(const SdfNode &node) {
+        nodes.push_back(node);
+        root = (int)nodes.size() - 1;
+        return root;
+    }
+
+    int sphere(float3 center, float radius, int block_id) {
+        SdfNode n{SDF_SPHERE};
+        n.center = center; n.a = radius; n.block_id = block_id;
+        return add(n);
+    }
+    int box(float3 center, float3 half_size, int block_id) {
+        SdfNode n{SDF_BOX};
+        n.center = center; n.size = half_size; n.block_id = block_id;
+        return add(n);
+    }
+    int torus(float3 center, float major_radius, float minor_radius, int block_id) {
+        SdfNode n{SDF_TORUS};
+        n.center = center; n.a = major_radius; n.b = minor_radius; n.block_id = block_id;
+        return add(n);
+    }
+    int capsule(float3 from, float3 to, float radius, int block_id) {
+        SdfNode n{SDF_CAPSULE};
+        n.center = from; n.size = to; n.a = radius; n.block_id = block_id;
+        return add(n);
+    }
+    int plane(float3 normal, float offset, int block_id) {
+        SdfNode n{SDF_PLANE};
+        n.size = normalize(normal); n.a = offset; n.block_id = block_id;
+        return add(n);
+    }
+    int op(SdfOp kind, int left, int right, float blend = 0.0f) {
+        SdfNode n{kind};
+        n.left = left; n.right = right; n.a = blend;
+        return add(n);
+    }
+    int unite(int left, int right)                   { return op(SDF_UNION, left, right); }
+    int intersect(int left, int right)               { return op(SDF_INTERSECTION, left, right); }
+    int subtract(int left, int right)                { return op(SDF_SUBTRACTION, left, right); }
+    int smooth_unite(int left, int right, float k)   { return op(SDF_SMOOTH_UNION, left, right, k); }
+
+    // Signed distance of subtree i; block_id receives the material at p. Subtraction and intersection
+    // keep the material of their left operand, unions take the nearer one.
+    float eval(int i, float3 p, int &block_id) const {
+        const SdfNode &n = nodes[i];
+        switch (n.op) {
+        case SDF_SPHERE:
+            block_id = n.block_id;
+            return length(p - n.center) - n.a;
+        case SDF_BOX: {
+            block_id = n.block_id;
+            float3 q = abs(p - n.center) - n.size;
+            return length(max(q, float3(0.0f))) + std::min(std::max(q.x, std::max(q.y, q.z)), 0.0f);
+        }
+        case SDF_TORUS: {
+            block_id = n.block_id;
+            float3 q = p - n.center;
+            float2 t = float2(length(float2(q.x, q.z)) - n.a, q.y);
+            return length(t) - n.b;
+        }
+        case SDF_CAPSULE: {
+            block_id = n.block_id;
+            float3 pa = p - n.center, ba = n.size - n.center;
+            float h = std::clamp(dot(pa, ba) / std::max(dot(ba, ba), 1e-12f), 0.0f, 1.0f);
+            return length(pa - ba * h) - n.a;
+        }
+        case SDF_PLANE:
+            block_id = n.block_id;
+            return dot(p, n.size) - n.a;
+        default:
+            break;
+        }
+
+        int left_id, right_id;
+        float dl = eval(n.left, p, left_id);
+        float dr = eval(n.right, p, right_id);
+        switch (n.op) {
+        case SDF_UNION:
+            block_id = dl <= dr ? left_id : right_id;
+            return std::min(dl, dr);
+        case SDF_INTERSECTION:
+            block_id = left_id;
+            return std::max(dl, dr);
+        case SDF_SUBTRACTION:
+            block_id = left_id;
+            return std::max(dl, -dr);
+        default: {
+            // polynomial smooth minimum
+            block_id = dl <= dr ? left_id : right_id;
+            float k = std::max(n.a, 1e-6f);
+            float h = std::clamp(0.5f + 0.5f * (dr - dl) / k, 0.0f, 1.0f);
+            return dr + (dl - dr) * h - k * h * (1.0f - h);
+        }
+        }
+    }
+
+    float distance(float3 p) const {
+        int block_id;
+        return eval(root, p, block_id);
+    }
+
+    // Material shared by every point within radius r of c that lies inside subtree i, -1 if it
+    // can not be proven from the bounds.
+    int uniform_material(int i, float3 c, float r) const {
+        const SdfNode &n = nodes[i];
+        if (n.left < 0) {
+            return n.block_id;
+        }
+        if (n.op == SDF_INTERSECTION || n.op == SDF_SUBTRACTION) {
+            return uniform_material(n.left, c, r);
+        }
+        int left_id, right_id;
+        float dl = eval(n.left, c, left_id);
+        float dr = eval(n.right, c, right_id);
+        float bound = 2.0f * lipschitz * r;
+        if (dl + bound < dr) return uniform_material(n.left, c, r);
+        if (dr + bound < dl) return uniform_material(n.right, c, r);
+        int l = uniform_material(n.left, c, r);
+        return l >= 0 && l == uniform_material(n.right, c, r) ? l : -1;
+    }
+};
+
+// Voxel (x, y, z) of the chunk is solid if the SDF is <= 0 at its centre.
+struct SdfChunkBuilder {
+    const SdfScene &scene;
+    int3 origin;
+    int size;
+
+    OctreeNode * build(int cur_size, int3 cur_pos) const {
+        OctreeNode *node = new OctreeNode;
+        for (int i = 0; i < 8; ++i) {
+            node->children[i] = NULL;
+        }
+
+        // bound over the voxel centres of the node
+        float3 c = float3(origin + cur_pos) + float3(cur_size * 0.5f);
+        float r = (cur_size - 1) * 0.5f * std::sqrt(3.0f);
+        int block_id;
+        float d = scene.eval(scene.root, c, block_id);
+        if (cur_size == 1) {
+            node->block_id = d <= 0.0f ? block_id : EMPTY;
+            return node;
+        }
+        if (d > scene.lipschitz * r) {
+            node->block_id = EMPTY;
+            return node;
+        }
+        if (d <= -scene.lipschitz * r) {
+            node->block_id = scene.uniform_material(scene.root, c, r);
+            if (node->block_id != -1) {
+                return node;
+            }
+        }
+
+        int new_size = cur_size / 2;
+        if (cur_size == size) {
+            // the root's octants are independent
+            #pragma omp parallel for
+            for (int i = 0; i < 8; ++i) {
+                node->children[i] = build(new_size, cur_pos + node_offset[i] * new_size);
+            }
+        } else {
+            for (int i = 0; i < 8; ++i) {
+                node->children[i] = build(new_size, cur_pos + node_offset[i] * new_size);
+            }
+        }
+        int id = node->children[0]->block_id;
+        for (int i = 1; i < 8; ++i) {
+            if (node->children[i]->block_id != id) {
+                id = -1;
+            }
+        }
+        node->block_id = id;
+        return node;
+    }
+};
+
+// Chunk of CHUNK_SIZE^3 voxels with minimum corner chunk_pos; only nodes the surface passes through
+// (or where materials meet) are subdivided.
+void build_SO_sdf(SparseOctree *tree, int3 chunk_pos, const SdfScene &scene) {
+    SdfChunkBuilder builder{scene, chunk_pos, CHUNK_SIZE};
+    build_SO_from_dummy(tree, builder.build(CHUNK_SIZE, int3(0, 0, 0)));
+}
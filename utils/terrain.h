@@ -0,0 +1,356 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "LiteMath.h"
+#include "blocks.h"
+#include "voxel_octree.h"
+
+using LiteMath::int3;
+using LiteMath::float3;
+
+// Procedural terrain: fractal Perlin heightmap, 3D noise caves and biome dependent block ids.
+// Noise is evaluated NOISE_LANES samples at a time in omp simd loops. The lattice hash is pure
+// integer arithmetic (no permutation table gathers), so every step maps onto vector instructions;
+// build with -march=native (NATIVE_ARCH=ON) to get 8 (AVX2) or 16 (AVX-512) lanes per instruction.
+
+const int NOISE_LANES = 16;
+
+inline uint32_t noise_hash(int x, int y, int z, uint32_t seed) {
+    uint32_t h = seed ^ (uint32_t(x) * 0x8da6b343u) ^ (uint32_t(y) * 0xd8163841u) ^ (uint32_t(z) * 0xcb1ab31fu);
+    h ^= h >> 13;
+    h *= 0x5bd1e995u;
+    h ^= h >> 15;
+    return h;
+}
+
+// std::floor is not vectorised without -fno-trapping-math, the integer version is
+inline int noise_floor(float x) {
+    int i = int(x);
+    return i - (x < float(i));
+}
+
+inline float noise_fade(float t) { return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f); }
+inline float noise_lerp(float a, float b, float t) { return a + t * (b - a); }
+
+// Perlin's 12 edge gradients (plus 4 repeats) selected by the low hash bits
+inline float noise_grad3(uint32_t h, float x, float y, float z) {
+    h &= 15;
+    float u = h < 8 ? x : y;
+    float v = h < 4 ? y : (h == 12 || h == 14 ? x : z);
+    return ((h & 1) ? -u : u) + ((h & 2) ? -v : v);
+}
+
+inline float noise_grad2(uint32_t h, float x, float y) {
+    h &= 7;
+    float u = h < 4 ? x : y;
+    float v = h < 4 ? y : x;
+    return ((h & 1) ? -u : u) + ((h & 2) ? -2.0f * v : 2.0f * v);
+}
+
+// Roughly in [-1, 1]
+inline float perlin3(float x, float y, float z, uint32_t seed) {
+    int ix = noise_floor(x), iy = noise_floor(y), iz = noise_floor(z);
+    x -= ix; y -= iy; z -= iz;
+    float u = noise_fade(x), v = noise_fade(y), w = noise_fade(z);
+
+    float n000 = noise_grad3(noise_hash(ix,     iy,     iz,     seed), x,        y,        z);
+    float n100 = noise_grad3(noise_hash(ix + 1, iy,     iz,     seed), x - 1.0f, y,        z);
+    float n010 = noise_grad3(noise_hash(ix,     iy + 1, iz,     seed), x,        y - 1.0f, z);
+    float n110 = noise_grad3(noise_hash(ix + 1, iy + 1, iz,     seed), x - 1.0f, y - 1.0f, z);
+    float n001 = noise_grad3(noise_hash(ix,     iy,     iz + 1, seed), x,        y,        z - 1.0f);
+    float n101 = noise_grad3(noise_hash(ix + 1, iy,     iz + 1, seed), x - 1.0f, y,        z - 1.0f);
+    float n011 = noise_grad3(noise_hash(ix,     iy + 1, iz + 1, seed), x,        y - 1.0f, z - 1.0f);
+    float n111 = noise_grad3(noise_hash(ix + 1, iy + 1, iz + 1, seed), x - 1.0f, y - 1.0f, z - 1.0f);
+
+    return noise_lerp(
+        noise_lerp(noise_lerp(n000, n100, u), noise_lerp(n010, n110, u), v),
+        noise_lerp(noise_lerp(n001, n101, u), noise_lerp(n011, n111, u), v),
+        w);
+}
+
+// Roughly in [-1, 1]
+inline float perlin2(float x, float y, uint32_t seed) {
+    int ix = noise_floor(x), iy = noise_floor(y);
+    x -= ix; y -= iy;
+    float u = noise_fade(x), v = noise_fade(y);
+
+    float n00 = noise_grad2(noise_hash(ix,     iy,     0, seed), x,        y);
+    float n10 = noise_grad2(noise_hash(ix + 1, iy,     0, seed), x - 1.0f, y);
+    float n01 = noise_grad2(noise_hash(ix,     iy + 1, 0, seed), x,        y - 1.0f);
+    float n11 = noise_grad2(noise_hash(ix + 1, iy + 1, 0, seed), x - 1.0f, y - 1.0f);
+
+    return 0.5f * noise_lerp(noise_lerp(n00, n10, u), noise_lerp(n01, n11, u), v);
+}
+
+enum Biome : uint8_t {
+    BIOME_PLAINS,
+    BIOME_DESERT,
+    BIOME_MOUNTAINS
+};
+
+struct TerrainGenerator {
+    uint32_t seed = 1337;
+    float base_height = 0.0f;
+    float height_scale = 24.0f;
+    float frequency = 1.0f / 96.0f;
+    int octaves = 5;
+    float lacunarity = 2.0f;
+    float gain = 0.5f;
+    float biome_frequency = 1.0f / 384.0f;
+    float cave_frequency = 1.0f / 24.0f;
+    float cave_threshold = 0.35f;  // 3D noise above it is carved out
+    int cave_min_depth = 4;        // caves stay this far below the surface
+    int sea_level = -12;
+    int soil_depth = 3;
+
+    // Surface height and biome of n <= NOISE_LANES columns
+    void columns(const int *x, const int *z, int n, int *height, uint8_t *biome) const {
+        float px[NOISE_LANES], pz[NOISE_LANES], sum[NOISE_LANES], temperature[NOISE_LANES];
+        #pragma omp simd
+        for (int i = 0; i < n; ++i) {
+            px[i] = x[i] * frequency;
+            pz[i] = z[i] * frequency;
+            sum[i] = 0.0f;
+            temperature[i] = perlin2(x[i] * biome_frequency, z[i] * biome_frequency, seed + 101);
+        }
+        float amplitude = 1.0f;
+        for (int o = 0; o < octaves; ++o) {
+            uint32_t octave_seed = seed + o * 7919;
+            #pragma omp simd
+            for (int i = 0; i < n; ++i) {
+                sum[i] += amplitude * perlin2(px[i], pz[i], octave_seed);
+                px[i] *= lacunarity;
+                pz[i] *= lacunarity;
+            }
+            amplitude *= gain;
+        }
+        #pragma omp simd
+        for (int i = 0; i < n; ++i) {
+            float t = temperature[i];
+            uint8_t b = t < -0.25f ? BIOME_MOUNTAINS : (t > 0.3f ? BIOME_DESERT : BIOME_PLAINS);
+            float scale = b == BIOME_MOUNTAINS ? 2.0f : (b == BIOME_DESERT ? 0.5f : 1.0f);
+            height[i] = noise_floor(base_height + height_scale * scale * sum[i]);
+            biome[i] = b;
+        }
+    }
+
+    // Block of a solid voxel depth voxels below the surface
+    int layer_block(uint8_t biome, int depth) const {
+        switch (biome) {
+        case BIOME_DESERT:    return depth <= soil_depth ? SAND : STONE;
+        case BIOME_MOUNTAINS: return depth == 0 ? SNOW : STONE;
+        default:              return depth == 0 ? GRASS : (depth <= soil_depth ? DIRT : STONE);
+        }
+    }
+
+    float cave_noise(int x, int y, int z) const {
+        return perlin3(x * cave_frequency, y * cave_frequency * 1.5f, z * cave_frequency, seed + 31);
+    }
+
+    // Single voxel of a column, same result as fill_column
+    int block_at(int x, int y, int z, int height, uint8_t biome) const {
+        if (y > height) {
+            return y <= sea_level ? WATER : EMPTY;
+        }
+        if (y <= height - cave_min_depth && cave_noise(x, y, z) > cave_threshold) {
+            return EMPTY;
+        }
+        return layer_block(biome, height - y);
+    }
+
+    // True if no voxel of the box [lo, hi] can be carved by a cave. perlin3 changes by at most
+    // NOISE_LIPSCHITZ per unit of noise space, so the value at the centre bounds the whole box.
+    bool cave_free(int3 lo, int3 hi) const {
+        if (cave_threshold >= 1.0f) {
+            return true;
+        }
+        const float NOISE_LIPSCHITZ = 4.5f;  // measured maximum gradient is ~3.45
+        float3 half = float3(hi - lo) * 0.5f * float3(cave_frequency, cave_frequency * 1.5f, cave_frequency);
+        float3 c = (float3(lo) + float3(hi)) * 0.5f;
+        float centre = perlin3(c.x * cave_frequency, c.y * cave_frequency * 1.5f, c.z * cave_frequency, seed + 31);
+        return centre + NOISE_LIPSCHITZ * length(half) <= cave_threshold;
+    }
+
+    // Fills count voxels of one column starting at y0, out[i] is the block at y0 + i
+    void fill_column(int x, int z, int height, uint8_t biome, int y0, int count, uint8_t *out) const {
+        for (int i = 0; i < count; ++i) {
+            int y = y0 + i;
+            out[i] = y <= height ? layer_block(biome, height - y) : (y <= sea_level ? WATER : EMPTY);
+        }
+
+        // caves, NOISE_LANES heights of the column per noise batch
+        int cave_top = std::min(height - cave_min_depth, y0 + count - 1);
+        float cx = x * cave_frequency, cz = z * cave_frequency;
+        for (int base = 0; y0 + base <= cave_top; base += NOISE_LANES) {
+            int n = std::min(NOISE_LANES, cave_top - (y0 + base) + 1);
+            float noise[NOISE_LANES];
+            #pragma omp simd
+            for (int i = 0; i < n; ++i) {
+                noise[i] = perlin3(cx, (y0 + base + i) * cave_frequency * 1.5f, cz, seed + 31);
+            }
+            for (int i = 0; i < n; ++i) {
+                if (noise[i] > cave_threshold) {
+                    out[base + i] = EMPTY;
+                }
+            }
+        }
+    }
+
+    // Surface height and biome of the size x size columns of a chunk, indexed x * size + z
+    void column_heights(int3 origin, int size, int *height, uint8_t *biome) const {
+        #pragma omp parallel for
+        for (int x = 0; x < size; ++x) {
+            int xs[NOISE_LANES], zs[NOISE_LANES];
+            for (int z0 = 0; z0 < size; z0 += NOISE_LANES) {
+                int n = std::min(NOISE_LANES, size - z0);
+                for (int i = 0; i < n; ++i) {
+                    xs[i] = origin.x + x;
+                    zs[i] = origin.z + z0 + i;
+                }
+                columns(xs, zs, n, height + x * size + z0, biome + x * size + z0);
+            }
+        }
+    }
+
+    // Fills a size^3 grid (layout of grid_index) for the chunk whose minimum corner is origin
+    void fill_chunk(int3 origin, int size, uint8_t *grid) const {
+        std::vector<int> heights(size * size);
+        std::vector<uint8_t> biomes(size * size);
+        column_heights(origin, size, heights.data(), biomes.data());
+
+        #pragma omp parallel for
+        for (int x = 0; x < size; ++x) {
+            for (int z = 0; z < size; ++z) {
+                fill_column(origin.x + x, origin.z + z, heights[x * size + z], biomes[x * size + z], origin.y, size,
+                    grid + grid_index(x, 0, z, size));
+            }
+        }
+    }
+};
+
+// Min and max surface height over every aligned square of columns. Level l holds squares of
+// side 1 << l, level 0 is the columns themselves.
+struct HeightPyramid {
+    int size = 0;
+    std::vector<std::vector<int>> min_h, max_h;
+
+    void build(const int *heights, int grid_size) {
+        size = grid_size;
+        min_h.assign(1, std::vector<int>(heights, heights + size * size));
+        max_h.assign(1, min_h[0]);
+        for (int side = size / 2; side >= 1; side /= 2) {
+            const std::vector<int> &pmin = min_h.back(), &pmax = max_h.back();
+            std::vector<int> cmin(side * side), cmax(side * side);
+            for (int x = 0; x < side; ++x) {
+                for (int z = 0; z < side; ++z) {
+                    int i00 = (2 * x) * (2 * side) + 2 * z, i10 = i00 + 2 * side;
+                    cmin[x * side + z] = std::min(std::min(pmin[i00], pmin[i00 + 1]), std::min(pmin[i10], pmin[i10 + 1]));
+                    cmax[x * side + z] = std::max(std::max(pmax[i00], pmax[i00 + 1]), std::max(pmax[i10], pmax[i10 + 1]));
+                }
+            }
+            min_h.push_back(std::move(cmin));
+            max_h.push_back(std::move(cmax));
+        }
+    }
+
+    // Square of side 1 << level containing column (x, z)
+    int min_at(int level, int x, int z) const { return min_h[level][(x >> level) * (size >> level) + (z >> level)]; }
+    int max_at(int level, int x, int z) const { return max_h[level][(x >> level) * (size >> level) + (z >> level)]; }
+};
+
+struct TerrainChunkBuilder {
+    const TerrainGenerator &generator;
+    int3 origin;
+    int size;
+    std::vector<int> heights;
+    std::vector<uint8_t> biomes;
+    HeightPyramid pyramid;
+
+    TerrainChunkBuilder(const TerrainGenerator &generator, int3 origin, int size)
+        : generator(generator), origin(origin), size(size), heights(size * size), biomes(size * size) {
+        generator.column_heights(origin, size, heights.data(), biomes.data());
+        pyramid.build(heights.data(), size);
+    }
+
+    // Block id shared by every voxel of the octant, -1 if it has to be subdivided
+    int uniform_block(int cur_size, int level, int3 cur_pos) const {
+        const TerrainGenerator &g = generator;
+        int min_h = pyramid.min_at(level, cur_pos.x, cur_pos.z);
+        int max_h = pyramid.max_at(level, cur_pos.x, cur_pos.z);
+        int y0 = origin.y + cur_pos.y, y1 = y0 + cur_size - 1;
+        if (y0 > max_h) {
+            if (y0 > g.sea_level) return EMPTY;
+            if (y1 <= g.sea_level) return WATER;
+            return -1;
+        }
+        // every layer_block is STONE deeper than soil_depth
+        if (y1 < min_h - g.soil_depth && g.cave_free(origin + cur_pos, origin + cur_pos + int3(cur_size - 1))) {
+            return STONE;
+        }
+        return -1;
+    }
+
+    OctreeNode * build(int cur_size, int level, int3 cur_pos) const {
+        OctreeNode *node = new OctreeNode;
+        for (int i = 0; i < 8; ++i) {
+            node->children[i] = NULL;
+        }
+        if (cur_size == 1) {
+            int col = cur_pos.x * size + cur_pos.z;
+            node->block_id = generator.block_at(origin.x + cur_pos.x, origin.y + cur_pos.y, origin.z + cur_pos.z,
+                heights[col], biomes[col]);
+            return node;
+        }
+        node->block_id = uniform_block(cur_size, level, cur_pos);
+        if (node->block_id != -1) {
+            return node;
+        }
+        int new_size = cur_size / 2;
+        if (cur_size == size) {
+            // the root's octants are independent
+            #pragma omp parallel for
+            for (int i = 0; i < 8; ++i) {
+                node->children[i] = build(new_size, level - 1, cur_pos + node_offset[i] * new_size);
+            }
+        } else {
+            for (int i = 0; i < 8; ++i) {
+                node->children[i] = build(new_size, level - 1, cur_pos + node_offset[i] * new_size);
+            }
+        }
+        int id = node->children[0]->block_id;
+        for (int i = 1; i < 8; ++i) {
+            if (node->children[i]->block_id != id) {
+                id = -1;
+            }
+        }
+        node->block_id = id;
+        return node;
+    }
+};
+
+// Chunk of CHUNK_SIZE^3 voxels generated column by column and encoded into tree
+void build_SO_terrain(SparseOctree *tree, int3 chunk_pos, const TerrainGenerator &generator) {
+    std::vector<uint8_t> grid((size_t)CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE);
+    generator.fill_chunk(chunk_pos, CHUNK_SIZE, grid.data());
+    build_SO_grid(tree, grid.data(), CHUNK_SIZE);
+}
+
+// Same chunk as build_SO_terrain, but octants that the height range of their columns proves to be
+// all air, water or stone become uniform nodes without visiting their voxels; only octants the
+// surface (or a possible cave) passes through are subdivided, so the cost follows the surface area.
+void build_SO_heightmap(SparseOctree *tree, int3 chunk_pos, const TerrainGenerator &generator, int size = CHUNK_SIZE) {
+    TerrainChunkBuilder builder(generator, chunk_pos, size);
+    int levels = 0;
+    while ((1 << levels) < size) {
+        levels++;
+    }
+    build_SO_from_dummy(tree, builder.build(size, levels, int3(0, 0, 0)));
+}
+
+// The world: world_size^3 voxels of terrain with the minimum corner at -world_size / 2
+void build_SO_world(SparseOctree *tree, int world_size, const TerrainGenerator &generator) {
+    build_SO_heightmap(tree, int3(-world_size / 2), generator, world_size);
+}
@@ -0,0 +1,478 @@
+#pragma once
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "LiteMath.h"
+#include "blocks.h"
+#include "instance_bvh.h"
+#include "mesh.h"
+
+using LiteMath::float2;
+using LiteMath::float3;
+using LiteMath::float4;
+using LiteMath::float4x4;
+using LiteMath::int2;
+
+// Triangle BVH for meshes rendered next to the voxel world.
+// A binary BVH is built with binned SAH (subtrees in parallel as omp tasks) and collapsed into a
+// 4-wide BVH: every node stores the bounds of its 4 children as SoA lanes and leaves store triangles
+// in packs of 4, so both the box and the triangle tests are 4-lane omp simd loops.
+
+const int BVH_WIDTH = 4;
+const int BVH_BINS = 16;
+const int BVH_MAX_LEAF = 8;
+// Binary nodes this deep become leaves whatever their size. Every 4-wide node popped pushes at most
+// 4 children, so the traversal stack never holds more than 3 entries per level plus the root.
+const int BVH_MAX_DEPTH = 48;
+const int BVH_STACK_SIZE = 3 * BVH_MAX_DEPTH + 1;
+const int BVH_EMPTY_CHILD = INT_MIN;
+
+struct Bvh4Node {
+    float bmin[3][BVH_WIDTH];
+    float bmax[3][BVH_WIDTH];
+    int child[BVH_WIDTH];      // >= 0 inner node, -1 - leaf index for leaves, BVH_EMPTY_CHILD if unused
+};
+
+// Pre-transformed triangles for Moller-Trumbore; unused lanes have id -1 and zero edges (never hit)
+struct TriPack4 {
+    float v0[3][BVH_WIDTH];
+    float e1[3][BVH_WIDTH];
+    float e2[3][BVH_WIDTH];
+    int id[BVH_WIDTH];
+};
+
+struct TriangleHit {
+    float t;
+    int tri;
+    float u, v;   // barycentrics of vertices 1 and 2
+};
+
+struct TriangleBVH {
+    std::vector<Bvh4Node> nodes;
+    std::vector<TriPack4> packs;
+    std::vector<int2> leaves;      // first pack, pack count
+    float3 bmin = float3(FLT_MAX), bmax = float3(-FLT_MAX);
+
+    struct BuildNode {
+        float3 bmin, bmax;
+        BuildNode *left = nullptr, *right = nullptr;
+        int first = 0, count = 0;
+        ~BuildNode() { delete left; delete right; }
+        float area() const {
+            float3 d = bmax - bmin;
+            return d.x * d.y + d.y * d.z + d.z * d.x;
+        }
+    };
+
+    static float box_area(float3 lo, float3 hi) {
+        float3 d = max(hi - lo, float3(0.0f));
+        return d.x * d.y + d.y * d.z + d.z * d.x;
+    }
+
+    BuildNode * build_node(std::vector<int> &index, const std::vector<float3> &tmin, const std::vector<float3> &tmax,
+                           const std::vector<float3> &centroid, int first, int count, int depth = 0) {
+        BuildNode *node = new BuildNode;
+        node->first = first;
+        node->count = count;
+        node->bmin = float3(FLT_MAX);
+        node->bmax = float3(-FLT_MAX);
+        float3 cmin = float3(FLT_MAX), cmax = float3(-FLT_MAX);
+        for (int i = first; i < first + count; ++i) {
+            node->bmin = min(node->bmin, tmin[index[i]]);
+            node->bmax = max(node->bmax, tmax[index[i]]);
+            cmin = min(cmin, centroid[index[i]]);
+            cmax = max(cmax, centroid[index[i]]);
+        }
+        if (count <= BVH_WIDTH || depth >= BVH_MAX_DEPTH) {
+            return node;
+        }
+
+        float3 extent = cmax - cmin;
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        int mid = first + count / 2;
+        if (extent[axis] <= 0.0f) {
+            // all centroids coincide, SAH can not separate them
+            if (count <= BVH_MAX_LEAF) {
+                return node;
+            }
+        } else {
+            int bin_count[BVH_BINS] = {};
+            float3 bin_min[BVH_BINS], bin_max[BVH_BINS];
+            for (int b = 0; b < BVH_BINS; ++b) {
+                bin_min[b] = float3(FLT_MAX);
+                bin_max[b] = float3(-FLT_MAX);
+            }
+            float scale = BVH_BINS / extent[axis];
+            auto bin_of = [&](int t) { return std::min(BVH_BINS - 1, int((centroid[t][axis] - cmin[axis]) * scale)); };
+            for (int i = first; i < first + count; ++i) {
+                int t = index[i], b = bin_of(t);
+                bin_count[b]++;
+                bin_min[b] = min(bin_min[b], tmin[t]);
+                bin_max[b] = max(bin_max[b], tmax[t]);
+            }
+
+            // sweep from the right, then evaluate every split from the left
+            float right_area[BVH_BINS];
+            int right_count[BVH_BINS];
+            float3 lo = float3(FLT_MAX), hi = float3(-FLT_MAX);
+            int n = 0;
+            for (int b = BVH_BINS - 1; b > 0; --b) {
+                lo = min(lo, bin_min[b]);
+                hi = max(hi, bin_max[b]);
+                n += bin_count[b];
+                right_area[b] = box_area(lo, hi);
+                right_count[b] = n;
+            }
+            float best_cost = FLT_MAX;
+            int best_split = -1;
+            lo = float3(FLT_MAX);
+            hi = float3(-FLT_MAX);
+            n = 0;
+            for (int b = 0; b < BVH_BINS - 1; ++b) {
+                lo = min(lo, bin_min[b]);
+                hi = max(hi, bin_max[b]);
+                n += bin_count[b];
+                if (n == 0 || right_count[b + 1] == 0) {
+                    continue;
+                }
+                float cost = box_area(lo, hi) * n + right_area[b + 1] * right_count[b + 1];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_split = b;
+                }
+            }
+
+            // traversal step counted as one triangle test
+            float leaf_cost = node->area() * (count - 1);
+            if (count <= BVH_MAX_LEAF && (best_split < 0 || best_cost >= leaf_cost)) {
+                return node;
+            }
+            if (best_split >= 0) {
+                mid = int(std::partition(index.begin() + first, index.begin() + first + count,
+                                         [&](int t) { return bin_of(t) <= best_split; }) - index.begin());
+            }
+        }
+        if (mid == first || mid == first + count) {
+            mid = first + count / 2;
+        }
+
+        if (count > 4096) {
+            #pragma omp task shared(index, tmin, tmax, centroid)
+            node->left = build_node(index, tmin, tmax, centroid, first, mid - first, depth + 1);
+            node->right = build_node(index, tmin, tmax, centroid, mid, first + count - mid, depth + 1);
+            #pragma omp taskwait
+        } else {
+            node->left = build_node(index, tmin, tmax, centroid, first, mid - first, depth + 1);
+            node->right = build_node(index, tmin, tmax, centroid, mid, first + count - mid, depth + 1);
+        }
+        return node;
+    }
+
+    int add_leaf(const BuildNode *node, const std::vector<int> &index, const cmesh4::SimpleMeshView &mesh) {
+        int first_pack = (int)packs.size();
+        for (int i = 0; i < node->count; i += BVH_WIDTH) {
+            TriPack4 pack = {};
+            for (int lane = 0; lane < BVH_WIDTH; ++lane) {
+                pack.id[lane] = -1;
+                if (i + lane >= node->count) {
+                    continue;
+                }
+                int t = index[node->first + i + lane];
+                float4 a = mesh.vPos4f[mesh.indices[3 * t]];
+                float4 b = mesh.vPos4f[mesh.indices[3 * t + 1]];
+                float4 c = mesh.vPos4f[mesh.indices[3 * t + 2]];
+                for (int k = 0; k < 3; ++k) {
+                    pack.v0[k][lane] = a[k];
+                    pack.e1[k][lane] = b[k] - a[k];
+                    pack.e2[k][lane] = c[k] - a[k];
+                }
+                pack.id[lane] = t;
+            }
+            packs.push_back(pack);
+        }
+        leaves.push_back(int2(first_pack, (int)packs.size() - first_pack));
+        return -1 - ((int)leaves.size() - 1);
+    }
+
+    // Collapses the binary node into a 4-wide node by opening its largest inner descendants
+    int collapse(const BuildNode *node, const std::vector<int> &index, const cmesh4::SimpleMeshView &mesh) {
+        const BuildNode *children[BVH_WIDTH] = {node->left, node->right};
+        int n = 2;
+        while (n < BVH_WIDTH) {
+            int open = -1;
+            for (int i = 0; i < n; ++i) {
+                if (children[i]->left && (open < 0 || children[i]->area() > children[open]->area())) {
+                    open = i;
+                }
+            }
+            if (open < 0) {
+                break;
+            }
+            const BuildNode *opened = children[open];
+            children[open] = opened->left;
+            children[n++] = opened->right;
+        }
+
+        int ind = (int)nodes.size();
+        nodes.emplace_back();
+        for (int i = 0; i < BVH_WIDTH; ++i) {
+            int child = BVH_EMPTY_CHILD;
+            float3 lo = float3(FLT_MAX), hi = float3(-FLT_MAX);
+            if (i < n) {
+                lo = children[i]->bmin;
+                hi = children[i]->bmax;
+                child = children[i]->left ? collapse(children[i], index, mesh) : add_leaf(children[i], index, mesh);
+            }
+            Bvh4Node &dst = nodes[ind];
+            dst.child[i] = child;
+            for (int k = 0; k < 3; ++k) {
+                dst.bmin[k][i] = lo[k];
+                dst.bmax[k][i] = hi[k];
+            }
+        }
+        return ind;
+    }
+
+    void build(const cmesh4::SimpleMeshView &mesh) {
+        nodes.clear();
+        packs.clear();
+        leaves.clear();
+        int tri_count = (int)mesh.TrianglesNum();
+        if (tri_count == 0) {
+            return;
+        }
+        std::vector<int> index(tri_count);
+        std::vector<float3> tmin(tri_count), tmax(tri_count), centroid(tri_count);
+        #pragma omp parallel for
+        for (int t = 0; t < tri_count; ++t) {
+            float4 a = mesh.vPos4f[mesh.indices[3 * t]];
+            float4 b = mesh.vPos4f[mesh.indices[3 * t + 1]];
+            float4 c = mesh.vPos4f[mesh.indices[3 * t + 2]];
+            tmin[t] = min(float3(a.x, a.y, a.z), min(float3(b.x, b.y, b.z), float3(c.x, c.y, c.z)));
+            tmax[t] = max(float3(a.x, a.y, a.z), max(float3(b.x, b.y, b.z), float3(c.x, c.y, c.z)));
+            centroid[t] = (tmin[t] + tmax[t]) * 0.5f;
+            index[t] = t;
+        }
+
+        BuildNode *root = nullptr;
+        #pragma omp parallel
+        #pragma omp single
+        root = build_node(index, tmin, tmax, centroid, 0, tri_count);
+
+        bmin = root->bmin;
+        bmax = root->bmax;
+        if (root->left) {
+            collapse(root, index, mesh);
+        } else {
+            // a single leaf still needs a node above it
+            nodes.emplace_back();
+            Bvh4Node &dst = nodes[0];
+            int leaf = add_leaf(root, index, mesh);
+            for (int i = 0; i < BVH_WIDTH; ++i) {
+                dst.child[i] = i == 0 ? leaf : BVH_EMPTY_CHILD;
+                for (int k = 0; k < 3; ++k) {
+                    dst.bmin[k][i] = i == 0 ? root->bmin[k] : FLT_MAX;
+                    dst.bmax[k][i] = i == 0 ? root->bmax[k] : -FLT_MAX;
+                }
+            }
+        }
+        delete root;
+    }
+
+    // Nearest triangle with t in (0, t_max), hit.t keeps t_max on a miss. With any_hit the first
+    // triangle found is returned instead (shadow rays).
+    bool intersect(float3 ro, float3 rd, float t_max, TriangleHit &hit, bool any_hit = false) const {
+        if (nodes.empty()) {
+            return false;
+        }
+        const float o[3] = {ro.x, ro.y, ro.z};
+        const float d[3] = {rd.x, rd.y, rd.z};
+        const float inv[3] = {1.0f / rd.x, 1.0f / rd.y, 1.0f / rd.z};
+        hit.t = t_max;
+        hit.tri = -1;
+
+        struct Entry { int node; float t; };
+        Entry stack[BVH_STACK_SIZE];
+        int sp = 0;
+        stack[sp++] = {0, 0.0f};
+        while (sp > 0) {
+            Entry e = stack[--sp];
+            if (e.t >= hit.t) {
+                continue;
+            }
+            if (e.node < 0) {
+                intersect_leaf(leaves[-1 - e.node], o, d, hit);
+                if (any_hit && hit.tri >= 0) {
+                    return true;
+                }
+                continue;
+            }
+
+            const Bvh4Node &node = nodes[e.node];
+            float t_near[BVH_WIDTH];
+            #pragma omp simd
+            for (int i = 0; i < BVH_WIDTH; ++i) {
+                float tx0 = (node.bmin[0][i] - o[0]) * inv[0], tx1 = (node.bmax[0][i] - o[0]) * inv[0];
+                float ty0 = (node.bmin[1][i] - o[1]) * inv[1], ty1 = (node.bmax[1][i] - o[1]) * inv[1];
+                float tz0 = (node.bmin[2][i] - o[2]) * inv[2], tz1 = (node.bmax[2][i] - o[2]) * inv[2];
+                float t0 = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::max(std::min(tz0, tz1), 0.0f));
+                float t1 = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::min(std::max(tz0, tz1), hit.t));
+                t_near[i] = t0 <= t1 ? t0 : FLT_MAX;
+            }
+
+            // push far to near so the nearest child is popped first
+            int order[BVH_WIDTH];
+            int n = 0;
+            for (int i = 0; i < BVH_WIDTH; ++i) {
+                if (t_near[i] != FLT_MAX && node.child[i] != BVH_EMPTY_CHILD) {
+                    int j = n++;
+                    while (j > 0 && t_near[order[j - 1]] < t_near[i]) {
+                        order[j] = order[j - 1];
+                        j--;
+                    }
+                    order[j] = i;
+                }
+            }
+            for (int j = 0; j < n; ++j) {
+                stack[sp++] = {node.child[order[j]], t_near[order[j]]};
+            }
+        }
+        return hit.tri >= 0;
+    }
+
+    void intersect_leaf(int2 leaf, const float o[3], const float d[3], TriangleHit &hit) const {
+        for (int p = leaf.x; p < leaf.x + leaf.y; ++p) {
+            const TriPack4 &pack = packs[p];
+            float t[BVH_WIDTH], u[BVH_WIDTH], v[BVH_WIDTH];
+            #pragma omp simd
+            for (int i = 0; i < BVH_WIDTH; ++i) {
+                float e1x = pack.e1[0][i], e1y = pack.e1[1][i], e1z = pack.e1[2][i];
+                float e2x = pack.e2[0][i], e2y = pack.e2[1][i], e2z = pack.e2[2][i];
+                float px = d[1] * e2z - d[2] * e2y, py = d[2] * e2x - d[0] * e2z, pz = d[0] * e2y - d[1] * e2x;
+                float det = e1x * px + e1y * py + e1z * pz;
+                float inv_det = det != 0.0f ? 1.0f / det : 0.0f;
+                float sx = o[0] - pack.v0[0][i], sy = o[1] - pack.v0[1][i], sz = o[2] - pack.v0[2][i];
+                float uu = (sx * px + sy * py + sz * pz) * inv_det;
+                float qx = sy * e1z - sz * e1y, qy = sz * e1x - sx * e1z, qz = sx * e1y - sy * e1x;
+                float vv = (d[0] * qx + d[1] * qy + d[2] * qz) * inv_det;
+                float tt = (e2x * qx + e2y * qy + e2z * qz) * inv_det;
+                bool valid = det != 0.0f && uu >= 0.0f && vv >= 0.0f && uu + vv <= 1.0f && tt > 1e-5f;
+                t[i] = valid ? tt : FLT_MAX;
+                u[i] = uu;
+                v[i] = vv;
+            }
+            for (int i = 0; i < BVH_WIDTH; ++i) {
+                if (t[i] < hit.t) {
+                    hit.t = t[i];
+                    hit.tri = pack.id[i];
+                    hit.u = u[i];
+                    hit.v = v[i];
+                }
+            }
+        }
+    }
+};
+
+// Mesh loaded once (memory mapped through the OBJ cache) with its BVH
+struct MeshAsset {
+    cmesh4::MappedMesh mesh;
+    TriangleBVH bvh;
+};
+
+struct MeshInstance {
+    int asset;
+    float4x4 transform;
+    float4x4 inverse;
+    int block_id = EMPTY;          // EMPTY: take the block id from matIndices
+};
+
+struct MeshScene {
+    std::vector<std::unique_ptr<MeshAsset>> assets;
+    std::vector<MeshInstance> instances;
+    InstanceBVH tlas;
+
+    // -1 if the file could not be loaded
+    int load_asset(const char *obj_path) {
+        std::unique_ptr<MeshAsset> asset(new MeshAsset);
+        if (!cmesh4::LoadMeshFromObjCached(obj_path, asset->mesh) || asset->mesh.view.TrianglesNum() == 0) {
+            printf("[MeshScene::ERROR] Failed to load mesh %s\n", obj_path);
+            return -1;
+        }
+        asset->bvh.build(asset->mesh.view);
+        assets.push_back(std::move(asset));
+        return (int)assets.size() - 1;
+    }
+
+    int add_instance(int asset, const float4x4 &transform, int block_id = EMPTY) {
+        MeshInstance inst;
+        inst.asset = asset;
+        inst.block_id = block_id;
+        instances.push_back(inst);
+        set_transform((int)instances.size() - 1, transform);
+        return (int)instances.size() - 1;
+    }
+
+    void set_transform(int instance, const float4x4 &transform) {
+        MeshInstance &inst = instances[instance];
+        inst.transform = transform;
+        inst.inverse = LiteMath::inverse4x4(transform);
+        const TriangleBVH &bvh = assets[inst.asset]->bvh;
+        float3 lo, hi;
+        transform_bounds(transform, bvh.bmin, bvh.bmax, lo, hi);
+        tlas.set_bounds(instance, lo, hi);
+    }
+
+    void update() { tlas.update(); }
+
+    // Nearest hit closer than t_max. Rays are moved into object space per instance; the direction is
+    // not renormalised, so object space t is the world space t.
+    bool intersect(float3 ro, float3 rd, float t_max, InstanceHit &out) const {
+        bool found = false;
+        tlas.traverse(ro, rd, t_max, [&](int i, float &t_limit) {
+            const MeshInstance &inst = instances[i];
+            const MeshAsset &asset = *assets[inst.asset];
+            TriangleHit hit;
+            if (asset.bvh.intersect(LiteMath::mul4x3(inst.inverse, ro), LiteMath::mul3x3(inst.inverse, rd), t_limit, hit)) {
+                t_limit = hit.t;
+                found = true;
+                shade_hit(inst, asset.mesh.view, hit, rd, out);
+            }
+        });
+        return found;
+    }
+
+    // Any triangle closer than t_max
+    bool occluded(float3 ro, float3 rd, float t_max) const {
+        bool found = false;
+        tlas.traverse(ro, rd, t_max, [&](int i, float &t_limit) {
+            const MeshInstance &inst = instances[i];
+            TriangleHit hit;
+            if (assets[inst.asset]->bvh.intersect(LiteMath::mul4x3(inst.inverse, ro), LiteMath::mul3x3(inst.inverse, rd), t_limit, hit, true)) {
+                found = true;
+                t_limit = -1.0f;    // ends the traversal
+            }
+        });
+        return found;
+    }
+
+    void shade_hit(const MeshInstance &inst, const cmesh4::SimpleMeshView &mesh, const TriangleHit &hit, float3 rd,
+                   InstanceHit &out) const {
+        unsigned int i0 = mesh.indices[3 * hit.tri], i1 = mesh.indices[3 * hit.tri + 1], i2 = mesh.indices[3 * hit.tri + 2];
+        float4 a = mesh.vPos4f[i0], b = mesh.vPos4f[i1], c = mesh.vPos4f[i2];
+        float3 n = cross(float3(b.x - a.x, b.y - a.y, b.z - a.z), float3(c.x - a.x, c.y - a.y, c.z - a.z));
+        n = normalize(LiteMath::mul3x3(LiteMath::transpose(inst.inverse), n));
+        out.t = hit.t;
+        out.normal = dot(n, rd) > 0.0f ? -n : n;
+        out.face = dominant_face(out.normal);
+        out.ao = 1.0f;
+        float w = 1.0f - hit.u - hit.v;
+        out.uv = mesh.vTexCoord2f[i0] * w + mesh.vTexCoord2f[i1] * hit.u + mesh.vTexCoord2f[i2] * hit.v;
+        unsigned int mat = mesh.matIndices[hit.tri];
+        out.block_id = inst.block_id != EMPTY ? inst.block_id : (mat >= 1 && mat <= (unsigned)BLOCK_TYPES ? (int)mat : STONE);
+    }
+};
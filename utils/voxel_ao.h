@@ -0,0 +1,221 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "LiteMath.h"
+#include "blocks.h"
+#include "voxel_octree.h"
+
+using LiteMath::float2;
+using LiteMath::int3;
+
+// Per-face ambient occlusion baked from neighbour occupancy.
+// A voxel face gets 4 corner values: a corner looks at the two voxels beside it and the one diagonal
+// to it in the layer in front of the face, and is 0 (both sides solid) to 3 (nothing solid). Corner c
+// of a face is (u high) << 1 | (v high) with u, v as in TextureAtlas::face_uv. Every leaf gets one
+// uint64_t in an array parallel to the octree nodes, so shading costs one extra fetch with the leaf
+// index the traversal already has. It normally packs 6 faces x 4 corners x 2 bits for the corners of
+// the whole leaf face, interpolated across it. When that interpolation misses occlusion inside a face
+// of a larger uniform leaf (a block next to the middle of it), the leaf is marked AO_DETAIL instead
+// and points to one byte of corner values per voxel face in OctreeAO::voxels.
+
+const float AO_SHADE[4] = {0.45f, 0.65f, 0.83f, 1.0f};
+
+struct OctreeLeaf {
+    int ind;
+    int size;
+    int3 pos;
+};
+
+void collect_octree_leaves(const unsigned int *nodes, const unsigned int *far, int ind, int cur_size, int3 cur_pos,
+                           std::vector<OctreeLeaf> &leaves) {
+    unsigned int node = nodes[ind];
+    if ((node & CHILD_MASK) == 0 && !(node & FAR_MASK)) {
+        if (node != EMPTY) {
+            leaves.push_back(OctreeLeaf{ind, cur_size, cur_pos});
+        }
+        return;
+    }
+    int half = cur_size / 2;
+    int first = node & FAR_MASK ? ind + far[(node & CHILD_MASK) >> 17] : ind + ((node & CHILD_MASK) >> 17);
+    int k = 0;
+    for (int i = 0; i < 8; ++i) {
+        if (node & ((1 << 15) >> i)) {
+            collect_octree_leaves(nodes, far, first + k, half, cur_pos + node_offset[i] * half, leaves);
+            k++;
+        }
+    }
+}
+
+// Axes of face f: normal axis, u axis and v axis (matching TextureAtlas::face_uv)
+inline void face_axes(int f, int &n_axis, int &u_axis, int &v_axis) {
+    if (f < 2) { n_axis = 0; u_axis = 2; v_axis = 1; }
+    else if (f < 4) { n_axis = 2; u_axis = 0; v_axis = 1; }
+    else { n_axis = 1; u_axis = 2; v_axis = 0; }
+}
+
+const uint64_t AO_DETAIL = 1ull << 63;      // low bits: offset of the leaf's 6 * size^2 bytes in voxels
+
+inline float bilinear_ao(unsigned int bits, float u, float v) {
+    float c00 = AO_SHADE[bits & 3], c01 = AO_SHADE[(bits >> 2) & 3];
+    float c10 = AO_SHADE[(bits >> 4) & 3], c11 = AO_SHADE[(bits >> 6) & 3];
+    return (c00 * (1.0f - v) + c01 * v) * (1.0f - u) + (c10 * (1.0f - v) + c11 * v) * u;
+}
+
+// Fills voxels with the corner values of every voxel face of the leaf (6 * size^2 bytes ordered f, u, v)
+// and returns the corner values of the whole leaf faces, or AO_DETAIL when interpolating those misses
+// the per voxel values on a visible voxel face.
+uint64_t leaf_ao(const unsigned int *nodes, const unsigned int *far, int size, const OctreeLeaf &leaf,
+                 std::vector<uint8_t> &voxels) {
+    int s = leaf.size, g = s + 2;
+    voxels.resize(6 * s * s);
+    std::vector<uint8_t> front(g * g);
+    uint64_t bits = 0;
+    bool detail = false;
+    for (int f = 0; f < 6; ++f) {
+        int n_axis, u_axis, v_axis;
+        face_axes(f, n_axis, u_axis, v_axis);
+        // occupancy of the layer in front of the face, with a one voxel border
+        for (int a = 0; a < g; ++a) {
+            for (int b = 0; b < g; ++b) {
+                int3 p = leaf.pos;
+                p[n_axis] += f % 2 == 0 ? s : -1;
+                p[u_axis] += a - 1;
+                p[v_axis] += b - 1;
+                front[a * g + b] = octree_block_at(nodes, far, size, p) != EMPTY ? 1 : 0;
+            }
+        }
+        uint8_t *face = &voxels[f * s * s];
+        for (int a = 0; a < s; ++a) {
+            for (int b = 0; b < s; ++b) {
+                uint8_t value = 0;
+                for (int c = 0; c < 4; ++c) {
+                    int du = c & 2 ? 1 : -1, dv = c & 1 ? 1 : -1;
+                    int side1 = front[(a + 1 + du) * g + b + 1], side2 = front[(a + 1) * g + b + 1 + dv];
+                    int corner = front[(a + 1 + du) * g + b + 1 + dv];
+                    value |= (side1 && side2 ? 0 : 3 - (side1 + side2 + corner)) << (c * 2);
+                }
+                face[a * s + b] = value;
+            }
+        }
+        unsigned int corners = (face[0] & 3) | (face[s - 1] & 0xC) | (face[(s - 1) * s] & 0x30) |
+                               (face[(s - 1) * s + s - 1] & 0xC0);
+        bits |= (uint64_t)corners << (f * 8);
+        // every voxel corner has to match the interpolation over the whole face
+        for (int a = 0; a < s && !detail && s > 1; ++a) {
+            for (int b = 0; b < s && !detail; ++b) {
+                if (front[(a + 1) * g + b + 1]) {
+                    continue;
+                }
+                for (int c = 0; c < 4; ++c) {
+                    float u = float(a + (c >> 1)) / s, v = float(b + (c & 1)) / s;
+                    if (std::abs(AO_SHADE[(face[a * s + b] >> (c * 2)) & 3] - bilinear_ao(corners, u, v)) > 0.01f) {
+                        detail = true;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    return detail ? AO_DETAIL : bits;
+}
+
+struct OctreeAO {
+    std::vector<uint64_t> nodes;    // per octree node (0 for inner and empty nodes)
+    std::vector<uint8_t> voxels;    // per voxel face corner values of AO_DETAIL leaves
+
+    bool empty() const { return nodes.empty(); }
+
+    // Shade factor at uv (TextureAtlas::face_uv of the hit relative to the leaf, in voxels) on face f of
+    // the given leaf
+    float sample(int leaf, int f, float2 uv, int leaf_size) const {
+        uint64_t ao = nodes[leaf];
+        if (ao & AO_DETAIL) {
+            int a = std::clamp((int)uv.x, 0, leaf_size - 1), b = std::clamp((int)uv.y, 0, leaf_size - 1);
+            unsigned int bits = voxels[(ao & ~AO_DETAIL) + (f * leaf_size + a) * leaf_size + b];
+            return bilinear_ao(bits, std::clamp(uv.x - a, 0.0f, 1.0f), std::clamp(uv.y - b, 0.0f, 1.0f));
+        }
+        float u = std::clamp(uv.x / leaf_size, 0.0f, 1.0f), v = std::clamp(uv.y / leaf_size, 0.0f, 1.0f);
+        return bilinear_ao((unsigned int)(ao >> (f * 8)), u, v);
+    }
+};
+
+void bake_octree_ao(const unsigned int *nodes, const unsigned int *far, int len, int size, OctreeAO &ao) {
+    ao.nodes.assign(len, 0);
+    ao.voxels.clear();
+    std::vector<OctreeLeaf> leaves;
+    collect_octree_leaves(nodes, far, 0, size, int3(0, 0, 0), leaves);
+    std::vector<std::vector<uint8_t>> detail(leaves.size());
+    #pragma omp parallel
+    {
+        std::vector<uint8_t> voxels;
+        #pragma omp for schedule(dynamic, 256)
+        for (int i = 0; i < (int)leaves.size(); ++i) {
+            ao.nodes[leaves[i].ind] = leaf_ao(nodes, far, size, leaves[i], voxels);
+            if (ao.nodes[leaves[i].ind] == AO_DETAIL) {
+                detail[i] = voxels;
+            }
+        }
+    }
+    for (int i = 0; i < (int)leaves.size(); ++i) {
+        if (!detail[i].empty()) {
+            ao.nodes[leaves[i].ind] |= ao.voxels.size();
+            ao.voxels.insert(ao.voxels.end(), detail[i].begin(), detail[i].end());
+        }
+    }
+}
+
+// Nodes whose AO can change with the voxel at p: the nodes within one voxel of it, and the children
+// at or after first_new of those (split off by octree_set_block). Inner and empty nodes are included,
+// their AO has to be cleared.
+void collect_nodes_near(const unsigned int *nodes, const unsigned int *far, int ind, int cur_size, int3 cur_pos, int3 p,
+                        int first_new, std::vector<OctreeLeaf> &found) {
+    unsigned int node = nodes[ind];
+    found.push_back(OctreeLeaf{ind, cur_size, cur_pos});
+    if ((node & CHILD_MASK) == 0 && !(node & FAR_MASK)) {
+        return;
+    }
+    int half = cur_size / 2;
+    int first = node & FAR_MASK ? ind + far[(node & CHILD_MASK) >> 17] : ind + ((node & CHILD_MASK) >> 17);
+    int k = 0;
+    for (int i = 0; i < 8; ++i) {
+        if (node & ((1 << 15) >> i)) {
+            int3 lo = cur_pos + node_offset[i] * half;
+            bool near = p.x >= lo.x - 1 && p.y >= lo.y - 1 && p.z >= lo.z - 1 &&
+                        p.x <= lo.x + half && p.y <= lo.y + half && p.z <= lo.z + half;
+            if (near || first + k >= first_new) {
+                collect_nodes_near(nodes, far, first + k, half, lo, p, first_new, found);
+            }
+            k++;
+        }
+    }
+}
+
+// Rebakes the leaves affected by setting the voxel at p; nodes from first_new on were added since
+// the last bake. The per voxel bytes of replaced AO_DETAIL leaves stay unused in ao.voxels.
+void update_octree_ao(const unsigned int *nodes, const unsigned int *far, int len, int size, int3 p, int first_new,
+                      OctreeAO &ao) {
+    ao.nodes.resize(len, 0);
+    std::vector<OctreeLeaf> found;
+    collect_nodes_near(nodes, far, 0, size, int3(0, 0, 0), p, first_new, found);
+    std::vector<uint8_t> voxels;
+    for (const OctreeLeaf &leaf : found) {
+        unsigned int node = nodes[leaf.ind];
+        if ((node & CHILD_MASK) || (node & FAR_MASK) || node == EMPTY) {
+            ao.nodes[leaf.ind] = 0;
+            continue;
+        }
+        uint64_t value = leaf_ao(nodes, far, size, leaf, voxels);
+        if (value == AO_DETAIL) {
+            value |= ao.voxels.size();
+            ao.voxels.insert(ao.voxels.end(), voxels.begin(), voxels.end());
+        }
+        ao.nodes[leaf.ind] = value;
+    }
+}
+
+void bake_octree_ao(const SparseOctree &tree, int size, OctreeAO &ao) {
+    bake_octree_ao(tree.nodes.data(), tree.far.data(), (int)tree.nodes.size(), size, ao);
+}
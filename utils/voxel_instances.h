@@ -0,0 +1,169 @@
+#pragma once
+#include <cfloat>
+#include <vector>
+
+#include "LiteMath.h"
+#include "blocks.h"
+#include "instance_bvh.h"
+#include "voxel_ao.h"
+#include "voxel_octree.h"
+
+using LiteMath::float2;
+using LiteMath::float3;
+using LiteMath::float4x4;
+using LiteMath::int3;
+
+// Instanced voxel objects: every model is one SparseOctree covering [0, size)^3 in object space and
+// any number of instances place it in the world with a transform, so repeated or moving objects cost
+// no voxel memory. The instances sit under an InstanceBVH that is refitted when they move, and each
+// ray is moved into object space (without renormalising, so t stays in world units) before the
+// model's octree is traversed.
+
+// Nearest non-empty leaf of tree along the ray with t < t_max. Children are visited in the order of
+// their index mirrored by the ray direction signs (bit 2 = x, bit 1 = y, bit 0 = z), which never
+// visits a child before one the ray passes through earlier, so the first hit is the nearest.
+// face is the face the ray entered the leaf through, as in traverse_octree, leaf the leaf's node index.
+int traverse_sparse_octree(const SparseOctree &tree, int ind, int cur_size, int3 cur_pos, float3 ray_origin, float3 inv_dir,
+                           int mirror, float t_max, float &dist, int3 &voxel_pos, int &voxel_size, int &face, int &leaf) {
+    float3 t0 = (float3(cur_pos) - ray_origin) * inv_dir;
+    float3 t1 = (float3(cur_pos) + float3(cur_size) - ray_origin) * inv_dir;
+    float3 t_min = min(t0, t1), t_far = max(t0, t1);
+    float t_enter = std::max(t_min.x, std::max(t_min.y, t_min.z));
+    float t_exit = std::min(t_far.x, std::min(t_far.y, t_far.z));
+    if (t_enter >= t_exit || t_exit <= 0 || t_enter >= t_max) {
+        return -1;
+    }
+
+    unsigned int node = tree.nodes[ind];
+    if ((node & CHILD_MASK) == 0 && !(node & FAR_MASK)) {
+        if (node == EMPTY) {
+            return -1;
+        }
+        dist = std::max(t_enter, 0.0f);
+        voxel_pos = cur_pos;
+        voxel_size = cur_size;
+        leaf = ind;
+        if (t_enter == t_min.x) {
+            face = inv_dir.x > 0 ? 1 : 0;
+        } else if (t_enter == t_min.y) {
+            face = inv_dir.y > 0 ? 5 : 4;
+        } else {
+            face = inv_dir.z > 0 ? 3 : 2;
+        }
+        return node;
+    }
+
+    int half = cur_size / 2;
+    int first = node & FAR_MASK ? ind + tree.far[(node & CHILD_MASK) >> 17] : ind + ((node & CHILD_MASK) >> 17);
+    for (int k = 0; k < 8; ++k) {
+        int i = k ^ mirror;
+        if (!(node & ((1 << 15) >> i))) {
+            continue;
+        }
+        int skip = 0;
+        for (int j = 0; j < i; ++j) {
+            skip += (node >> (15 - j)) & 1;
+        }
+        int id = traverse_sparse_octree(tree, first + skip, half, cur_pos + node_offset[i] * half, ray_origin, inv_dir, mirror,
+                                        t_max, dist, voxel_pos, voxel_size, face, leaf);
+        if (id > 0) {
+            return id;
+        }
+    }
+    return -1;
+}
+
+struct VoxelModel {
+    SparseOctree tree;
+    int size;               // power of two side of the octree in voxels
+    OctreeAO ao;            // baked AO, see voxel_ao.h
+};
+
+struct VoxelInstance {
+    int model;
+    float4x4 transform;     // object space (voxel units of the model) to world
+    float4x4 inverse;
+};
+
+struct VoxelScene {
+    std::vector<VoxelModel> models;
+    std::vector<VoxelInstance> instances;
+    InstanceBVH tlas;
+
+    int add_model(SparseOctree &&tree, int size) {
+        models.push_back(VoxelModel{std::move(tree), size, {}});
+        bake_octree_ao(models.back().tree, size, models.back().ao);
+        return (int)models.size() - 1;
+    }
+
+    int add_instance(int model, const float4x4 &transform) {
+        VoxelInstance inst;
+        inst.model = model;
+        instances.push_back(inst);
+        set_transform((int)instances.size() - 1, transform);
+        return (int)instances.size() - 1;
+    }
+
+    // Moves an instance; the top level is refitted on the next update()
+    void set_transform(int instance, const float4x4 &transform) {
+        VoxelInstance &inst = instances[instance];
+        inst.transform = transform;
+        inst.inverse = LiteMath::inverse4x4(transform);
+        float3 lo, hi;
+        transform_bounds(transform, float3(0.0f), float3((float)models[inst.model].size), lo, hi);
+        tlas.set_bounds(instance, lo, hi);
+    }
+
+    void update() { tlas.update(); }
+
+    // Nearest hit closer than t_max
+    bool intersect(float3 ro, float3 rd, float t_max, InstanceHit &out) const {
+        bool found = false;
+        tlas.traverse(ro, rd, t_max, [&](int i, float &t_limit) {
+            const VoxelInstance &inst = instances[i];
+            const VoxelModel &model = models[inst.model];
+            float3 o = LiteMath::mul4x3(inst.inverse, ro);
+            float3 d = LiteMath::mul3x3(inst.inverse, rd);
+            int mirror = (d.x < 0 ? 4 : 0) | (d.y < 0 ? 2 : 0) | (d.z < 0 ? 1 : 0);
+            float dist;
+            int3 voxel_pos;
+            int voxel_size, face, leaf;
+            int id = traverse_sparse_octree(model.tree, 0, model.size, int3(0, 0, 0), o, float3(1.0f) / d, mirror, t_limit,
+                                            dist, voxel_pos, voxel_size, face, leaf);
+            if (id <= 0) {
+                return;
+            }
+            t_limit = dist;
+            found = true;
+            float3 n = normalize(LiteMath::mul3x3(LiteMath::transpose(inst.inverse), face_normal[face]));
+            out.t = dist;
+            out.normal = n;
+            out.face = dominant_face(n);
+            out.uv = TextureAtlas::face_uv(o + d * dist - float3(voxel_pos), face);
+            out.ao = model.ao.sample(leaf, face, out.uv, voxel_size);
+            out.block_id = id;
+        });
+        return found;
+    }
+
+    // Any voxel closer than t_max
+    bool occluded(float3 ro, float3 rd, float t_max) const {
+        bool found = false;
+        tlas.traverse(ro, rd, t_max, [&](int i, float &t_limit) {
+            const VoxelInstance &inst = instances[i];
+            const VoxelModel &model = models[inst.model];
+            float3 o = LiteMath::mul4x3(inst.inverse, ro);
+            float3 d = LiteMath::mul3x3(inst.inverse, rd);
+            int mirror = (d.x < 0 ? 4 : 0) | (d.y < 0 ? 2 : 0) | (d.z < 0 ? 1 : 0);
+            float dist;
+            int3 voxel_pos;
+            int voxel_size, face, leaf;
+            if (traverse_sparse_octree(model.tree, 0, model.size, int3(0, 0, 0), o, float3(1.0f) / d, mirror, t_limit,
+                                       dist, voxel_pos, voxel_size, face, leaf) > 0) {
+                found = true;
+                t_limit = -1.0f;    // ends the traversal
+            }
+        });
+        return found;
+    }
+};
@@ -1,4 +1,8 @@
+#pragma once
 #include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
 #include "LiteMath.h"
 
 using LiteMath::int3;
@@ -119,7 +123,7 @@ int build_real_octree(SparseOctree *tree, OctreeNode *dummy_node, int cur_offset
             unsigned int offset = build_real_octree(tree, dummy_node->children[i], old_octree_len - new_len + ind);
             if (offset >= 32768) { // 2^15
                 tree->nodes[old_octree_len - new_len + ind] |= FAR_MASK;
-                tree->nodes[old_octree_len - new_len + ind] |= (octree_far_len << 17);
+                tree->nodes[old_octree_len - new_len + ind] |= (tree->far_len << 17);
                 tree->far.push_back(offset);
                 tree->far_len++;
             } else {
@@ -151,11 +155,12 @@ void print_dummy_octree(OctreeNode *cur_node) {
     std::cout << "--------+--------\n";
 }
 
-void build_SO(SparseOctree *tree, int3 cur_pos) {
-    OctreeNode *dummy_root = build_dummy_octree(CHUNK_SIZE, cur_pos);
+// Encodes a finished dummy octree into tree and frees it
+void build_SO_from_dummy(SparseOctree *tree, OctreeNode *dummy_root) {
     if (dummy_root->block_id != -1) {
         tree->nodes.push_back(dummy_root->block_id);
         tree->len = 1;
+        free_dummy_octree(dummy_root);
         return;
     }
     unsigned int cur_node = (1 << 17);
@@ -174,6 +179,196 @@ void build_SO(SparseOctree *tree, int3 cur_pos) {
     free_dummy_octree(dummy_root);
 }
 
+void build_SO(SparseOctree *tree, int3 cur_pos) {
+    build_SO_from_dummy(tree, build_dummy_octree(CHUNK_SIZE, cur_pos));
+}
+
+// Dense block grids are stored column by column: y is the fastest axis, then z, then x
+inline int grid_index(int x, int y, int z, int size) {
+    return (x * size + z) * size + y;
+}
+
+// Uniform nodes are returned without children, so their voxels are not kept as separate nodes
+OctreeNode * build_dummy_octree_grid(const uint8_t *grid, int grid_size, int cur_size, int3 cur_pos) {
+    OctreeNode *node = new OctreeNode;
+    for (int i = 0; i < 8; ++i) {
+        node->children[i] = NULL;
+    }
+    if (cur_size == 1) {
+        node->block_id = grid[grid_index(cur_pos.x, cur_pos.y, cur_pos.z, grid_size)];
+        return node;
+    }
+    if (cur_size == 2) {
+        // most 2^3 blocks are uniform, check them before allocating the voxels
+        int first = grid[grid_index(cur_pos.x, cur_pos.y, cur_pos.z, grid_size)];
+        bool uniform = true;
+        for (int i = 1; i < 8 && uniform; ++i) {
+            int3 p = cur_pos + node_offset[i];
+            uniform = grid[grid_index(p.x, p.y, p.z, grid_size)] == first;
+        }
+        if (uniform) {
+            node->block_id = first;
+            return node;
+        }
+    }
+    int new_size = cur_size / 2;
+    int id = -1;
+    for (int i = 0; i < 8; ++i) {
+        node->children[i] = build_dummy_octree_grid(grid, grid_size, new_size, cur_pos + node_offset[i] * new_size);
+        if (i == 0) { 
+            id = node->children[i]->block_id;
+        } else {
+            if (node->children[i]->block_id != id) {
+                id = -1;
+            }
+        }
+    }
+    node->block_id = id;
+    if (id != -1) {
+        for (int i = 0; i < 8; ++i) {
+            free_dummy_octree(node->children[i]);
+            node->children[i] = NULL;
+        }
+    }
+    return node;
+}
+
+// Builds a chunk from a grid_size^3 block grid (grid_size must be a power of two)
+void build_SO_grid(SparseOctree *tree, const uint8_t *grid, int grid_size) {
+    build_SO_from_dummy(tree, build_dummy_octree_grid(grid, grid_size, grid_size, int3(0, 0, 0)));
+}
+
+// Block at voxel p of an encoded octree of the given size, 0 (empty) outside it
+int octree_block_at(const unsigned int *nodes, const unsigned int *far, int size, int3 p) {
+    if (p.x < 0 || p.y < 0 || p.z < 0 || p.x >= size || p.y >= size || p.z >= size) {
+        return 0;
+    }
+    int ind = 0;
+    while (true) {
+        unsigned int node = nodes[ind];
+        if ((node & CHILD_MASK) == 0 && !(node & FAR_MASK)) {
+            return node;
+        }
+        size /= 2;
+        int i = ((p.x >= size) << 2) | ((p.y >= size) << 1) | (p.z >= size);
+        p = p - node_offset[i] * size;
+        if (!(node & ((1 << 15) >> i))) {
+            return 0;
+        }
+        int first = node & FAR_MASK ? ind + far[(node & CHILD_MASK) >> 17] : ind + ((node & CHILD_MASK) >> 17);
+        int skip = 0;
+        for (int j = 0; j < i; ++j) {
+            skip += (node >> (15 - j)) & 1;
+        }
+        ind = first + skip;
+    }
+}
+
+// Points node ind at its children starting at index first, through the far table if the offset does
+// not fit into the node
+void set_child_offset(SparseOctree *tree, int ind, int first) {
+    unsigned int offset = first - ind;
+    unsigned int node = tree->nodes[ind] & ~(CHILD_MASK | FAR_MASK);
+    if (offset >= 32768) { // 2^15
+        node |= FAR_MASK | (tree->far_len << 17);
+        tree->far.push_back(offset);
+        tree->far_len++;
+    } else {
+        node |= offset << 17;
+    }
+    tree->nodes[ind] = node;
+}
+
+// Sets the block at voxel p (inside the octree of the given size) of an encoded octree. A uniform leaf
+// on the way is split into 8 leaves appended at the end of nodes, so existing nodes keep their
+// indices and arrays parallel to the nodes only need to grow. path receives the nodes from the root
+// down to the leaf holding p. Returns false when the far table is full, see compact_octree.
+bool octree_set_block(SparseOctree *tree, int size, int3 p, int block_id, std::vector<int> &path) {
+    path.clear();
+    int ind = 0;
+    while (true) {
+        path.push_back(ind);
+        unsigned int node = tree->nodes[ind];
+        if ((node & CHILD_MASK) == 0 && !(node & FAR_MASK)) {
+            if ((int)node == block_id || size == 1) {
+                tree->nodes[ind] = block_id;
+                return true;
+            }
+            if (tree->far_len >= 32767) {
+                return false;
+            }
+            int first = (int)tree->nodes.size();
+            tree->nodes.insert(tree->nodes.end(), 8, node);
+            tree->len += 8;
+            tree->nodes[ind] = VALID_MASK | LEAF_MASK;
+            set_child_offset(tree, ind, first);
+            node = tree->nodes[ind];
+        }
+        size /= 2;
+        int i = ((p.x >= size) << 2) | ((p.y >= size) << 1) | (p.z >= size);
+        p = p - node_offset[i] * size;
+        if (!(node & ((1 << 15) >> i))) {
+            // the builders always encode all 8 octants
+            printf("[octree_set_block::ERROR] Node %d has no octant %d\n", ind, i);
+            return false;
+        }
+        int first = node & FAR_MASK ? ind + tree->far[(node & CHILD_MASK) >> 17] : ind + ((node & CHILD_MASK) >> 17);
+        int skip = 0;
+        for (int j = 0; j < i; ++j) {
+            skip += (node >> (15 - j)) & 1;
+        }
+        int child = first + skip;
+        // the child stays a leaf only if the edit ends in it
+        unsigned int child_node = tree->nodes[child];
+        bool child_leaf = (child_node & CHILD_MASK) == 0 && !(child_node & FAR_MASK) && ((int)child_node == block_id || size == 1);
+        if (child_leaf) {
+            tree->nodes[ind] |= (1 << 7) >> i;
+        } else {
+            tree->nodes[ind] &= ~((1u << 7) >> i);
+        }
+        ind = child;
+    }
+}
+
+OctreeNode * decode_dummy_octree(const SparseOctree &tree, int ind) {
+    OctreeNode *node = new OctreeNode;
+    for (int i = 0; i < 8; ++i) {
+        node->children[i] = NULL;
+    }
+    unsigned int value = tree.nodes[ind];
+    if ((value & CHILD_MASK) == 0 && !(value & FAR_MASK)) {
+        node->block_id = value;
+        return node;
+    }
+    int first = value & FAR_MASK ? ind + tree.far[(value & CHILD_MASK) >> 17] : ind + ((value & CHILD_MASK) >> 17);
+    int id = -1;
+    for (int i = 0; i < 8; ++i) {
+        node->children[i] = decode_dummy_octree(tree, first + i);
+        if (i == 0) {
+            id = node->children[i]->block_id;
+        } else if (node->children[i]->block_id != id) {
+            id = -1;
+        }
+    }
+    // octants edited back to one block become uniform again
+    node->block_id = id;
+    if (id != -1) {
+        for (int i = 0; i < 8; ++i) {
+            free_dummy_octree(node->children[i]);
+            node->children[i] = NULL;
+        }
+    }
+    return node;
+}
+
+// Encodes the octree again so that nodes added by octree_set_block sit next to their parents and the
+// far table empties; node indices change
+void compact_octree(SparseOctree *tree) {
+    SparseOctree compact;
+    build_SO_from_dummy(&compact, decode_dummy_octree(*tree, 0));
+    *tree = std::move(compact);
+}
+
 void printBinary(int num) {
     for (int i = 31; i >= 0; i--) {
         std::cout << ((num >> i) & 1);
@@ -182,8 +377,11 @@ void printBinary(int num) {
     std::cout << '\n';
 }
 
+// face receives the face the ray entered the hit node through (+x -x +z -z +y -y, see face_normal):
+// it is the axis of t_enter, taken from the slab test, so no reconstruction from the hit point is needed.
+// leaf, if given, receives the node index of the hit leaf (for per-node attributes such as baked AO).
 int traverse_octree(float3 ray_origin, float3 ray_dir, int cur_ind, int cur_size, int3 cur_pos, 
-    float &dist, int3 &voxel_pos, int &voxel_size) {
+    float &dist, int3 &voxel_pos, int &voxel_size, int &face, int *leaf = nullptr) {
     float3 t0 = (float3(cur_pos) - ray_origin) / ray_dir;
     float3 t1 = (float3(cur_pos) + float3(cur_size) - ray_origin) / ray_dir;
     float3 t_min = float3(ray_dir.x > 0 ? t0.x : t1.x, ray_dir.y > 0 ? t0.y : t1.y, ray_dir.z > 0 ? t0.z : t1.z);
@@ -198,6 +396,16 @@ int traverse_octree(float3 ray_origin, float3 ray_dir, int cur_ind, int cur_size
             dist = t_enter;
             voxel_pos = cur_pos;
             voxel_size = cur_size;
+            if (leaf) {
+                *leaf = cur_ind;
+            }
+            if (t_enter == t_min.x) {
+                face = ray_dir.x > 0 ? 1 : 0;
+            } else if (t_enter == t_min.y) {
+                face = ray_dir.y > 0 ? 5 : 4;
+            } else {
+                face = ray_dir.z > 0 ? 3 : 2;
+            }
             return world_octree[cur_ind];
         }
         bool flag = false;
@@ -215,8 +423,10 @@ int traverse_octree(float3 ray_origin, float3 ray_dir, int cur_ind, int cur_size
             float cur_dist;
             int3 cur_voxel_pos;
             int cur_voxel_size;
+            int cur_face;
+            int cur_leaf;
             if (world_octree[cur_ind] & ((1 << 15) >> i)) {
-                cur_id = traverse_octree(ray_origin, ray_dir, new_ind + ind, half_size, cur_pos + node_offset[i] * half_size, cur_dist, cur_voxel_pos, cur_voxel_size);
+                cur_id = traverse_octree(ray_origin, ray_dir, new_ind + ind, half_size, cur_pos + node_offset[i] * half_size, cur_dist, cur_voxel_pos, cur_voxel_size, cur_face, leaf ? &cur_leaf : nullptr);
                 ind++;
                 if (cur_id != -1 && cur_id != 0) {
                     if (!flag || cur_dist < dist) {
@@ -224,6 +434,10 @@ int traverse_octree(float3 ray_origin, float3 ray_dir, int cur_ind, int cur_size
                         dist = cur_dist;
                         voxel_pos = cur_voxel_pos;
                         voxel_size = cur_voxel_size;
+                        face = cur_face;
+                        if (leaf) {
+                            *leaf = cur_leaf;
+                        }
                         flag = true;
                     }
                 }
@@ -239,6 +453,39 @@ int traverse_octree(float3 ray_origin, float3 ray_dir, int cur_ind, int cur_size
 }
 
 
+// Any solid leaf closer than t_max, for shadow rays: stops at the first one found instead of the nearest
+bool traverse_octree_any(float3 ray_origin, float3 ray_dir, int cur_ind, int cur_size, int3 cur_pos, float t_max) {
+    float3 t0 = (float3(cur_pos) - ray_origin) / ray_dir;
+    float3 t1 = (float3(cur_pos) + float3(cur_size) - ray_origin) / ray_dir;
+    float3 t_min = min(t0, t1);
+    float3 t_far = max(t0, t1);
+    float t_enter = std::max(t_min.x, std::max(t_min.y, t_min.z));
+    float t_exit = std::min(t_far.x, std::min(t_far.y, t_far.z));
+    if (t_enter >= t_exit || t_exit <= 0 || t_enter >= t_max) {
+        return false;
+    }
+    if ((world_octree[cur_ind] & CHILD_MASK) == 0 && !(world_octree[cur_ind] & FAR_MASK)) {
+        return world_octree[cur_ind] != 0;
+    }
+    int half_size = cur_size / 2;
+    int new_ind;
+    if (world_octree[cur_ind] & FAR_MASK)
+        new_ind = cur_ind + octree_far[(world_octree[cur_ind] & CHILD_MASK) >> 17];
+    else
+        new_ind = cur_ind + ((world_octree[cur_ind] & CHILD_MASK) >> 17);
+    int ind = 0;
+    for (int i = 0; i < 8; ++i) {
+        if (world_octree[cur_ind] & ((1 << 15) >> i)) {
+            if (traverse_octree_any(ray_origin, ray_dir, new_ind + ind, half_size, cur_pos + node_offset[i] * half_size, t_max)) {
+                return true;
+            }
+            ind++;
+        }
+    }
+    return false;
+}
+
+
 void build_tlSO(TLNode *cur, int3 cur_pos, int3 size_chunks) {
     if (size_chunks.x == 1 && size_chunks.y == 1) {
         cur->tree = new SparseOctree;
@@ -263,10 +510,10 @@ void build_tlSO(TLNode *cur, int3 cur_pos, int3 size_chunks) {
 }
 
 int tlSO_traverse(TLNode *node, float3 ray_origin, float3 ray_dir, int3 cur_size, int3 cur_pos, 
-    float &dist, int3 &voxel_pos, int &voxel_size) {
+    float &dist, int3 &voxel_pos, int &voxel_size, int &face) {
 
     if (node->tree != NULL) {
-        return traverse_octree(ray_origin, ray_dir, 0, CHUNK_SIZE, cur_pos, dist, voxel_pos, voxel_size);
+        return traverse_octree(ray_origin, ray_dir, 0, CHUNK_SIZE, cur_pos, dist, voxel_pos, voxel_size, face);
     } 
     bool flag = false;
     int min_id;
@@ -276,14 +523,16 @@ int tlSO_traverse(TLNode *node, float3 ray_origin, float3 ray_dir, int3 cur_size
             float cur_dist;
             int3 cur_voxel_pos;
             int cur_voxel_size;
+            int cur_face;
             int cur_id = tlSO_traverse(node->children[i], ray_origin, ray_dir, 
                 new_size, cur_pos + new_size * tlnode_offset[i], 
-                cur_dist, cur_voxel_pos, cur_voxel_size);
+                cur_dist, cur_voxel_pos, cur_voxel_size, cur_face);
             if (cur_id != -1 && cur_id != 0) {
                 if (!flag || cur_dist < dist) {
                     dist = cur_dist;
                     voxel_pos = cur_voxel_pos;
                     voxel_size = cur_voxel_Size;
+                    face = cur_face;
                     min_id = cur_id;
                 }
             }
@@ -294,14 +543,16 @@ int tlSO_traverse(TLNode *node, float3 ray_origin, float3 ray_dir, int3 cur_size
             float cur_dist;
             int3 cur_voxel_pos;
             int cur_voxel_size;
+            int cur_face;
             int cur_id = tlSO_traverse(node->children[i], ray_origin, ray_dir, 
                 new_size, cur_pos + new_size * tlnode_offset[i], 
-                cur_dist, cur_voxel_pos, cur_voxel_size);
+                cur_dist, cur_voxel_pos, cur_voxel_size, cur_face);
             if (cur_id != -1 && cur_id != 0) {
                 if (!flag || cur_dist < dist) {
                     dist = cur_dist;
                     voxel_pos = cur_voxel_pos;
                     voxel_size = cur_voxel_Size;
+                    face = cur_face;
                     min_id = cur_id;
                 }
             }
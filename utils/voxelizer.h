@@ -0,0 +1,306 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "LiteMath.h"
+#include "blocks.h"
+#include "mesh.h"
+#include "voxel_octree.h"
+
+using LiteMath::float2;
+using LiteMath::float3;
+using LiteMath::int3;
+
+// Mesh voxelisation into sparse octree chunks.
+// Every voxel a triangle touches becomes solid (exact triangle/box overlap, so thin features never
+// fall between voxel centres). Triangles are binned by the chunks their bounding boxes cover and
+// chunks are voxelised independently in parallel. With solid_fill the inside of closed meshes is
+// filled by counting surface crossings of a vertical ray through every voxel column.
+
+struct VoxelizeSettings {
+    float voxel_size = 1.0f;            // mesh units per voxel
+    int3 origin = int3(0, 0, 0);        // voxel the minimum corner of the mesh bounding box lands on
+    bool solid_fill = false;
+    std::vector<int> material_blocks;   // matIndices -> block id
+    int default_block = STONE;          // materials without an entry in material_blocks
+};
+
+struct VoxelizedMesh {
+    std::vector<int3> chunk_pos;        // minimum voxel corner of each chunk
+    std::vector<SparseOctree> chunks;
+};
+
+// Akenine-Moller separating axis test of a triangle against an axis aligned box
+inline bool tri_box_overlap(float3 center, float3 half, float3 a, float3 b, float3 c) {
+    float3 v0 = a - center, v1 = b - center, v2 = c - center;
+    float3 e[3] = {v1 - v0, v2 - v1, v0 - v2};
+
+    // 9 axes: box axes crossed with the edges
+    for (int i = 0; i < 3; ++i) {
+        float3 ax[3] = {float3(0, -e[i].z, e[i].y), float3(e[i].z, 0, -e[i].x), float3(-e[i].y, e[i].x, 0)};
+        for (int j = 0; j < 3; ++j) {
+            float p0 = dot(v0, ax[j]), p1 = dot(v1, ax[j]), p2 = dot(v2, ax[j]);
+            float r = half.x * std::abs(ax[j].x) + half.y * std::abs(ax[j].y) + half.z * std::abs(ax[j].z);
+            if (std::min(p0, std::min(p1, p2)) > r || std::max(p0, std::max(p1, p2)) < -r) {
+                return false;
+            }
+        }
+    }
+
+    // box faces
+    for (int k = 0; k < 3; ++k) {
+        if (std::min(v0[k], std::min(v1[k], v2[k])) > half[k] || std::max(v0[k], std::max(v1[k], v2[k])) < -half[k]) {
+            return false;
+        }
+    }
+
+    // triangle plane
+    float3 n = cross(e[0], e[1]);
+    float3 vmax;
+    for (int k = 0; k < 3; ++k) {
+        vmax[k] = n[k] > 0.0f ? half[k] : -half[k];
+    }
+    float d = dot(n, v0);
+    return dot(n, -vmax) <= d && d <= dot(n, vmax);
+}
+
+// Height where the vertical line through (x, z) crosses triangle abc, false if it misses. Edges use
+// a top-left rule so a line through a shared edge is counted for exactly one of the two triangles.
+inline bool vertical_crossing(float x, float z, float3 a, float3 b, float3 c, float &y) {
+    float area = (b.x - a.x) * (c.z - a.z) - (b.z - a.z) * (c.x - a.x);
+    if (area == 0.0f) {
+        return false;
+    }
+    if (area < 0.0f) {
+        std::swap(b, c);
+        area = -area;
+    }
+    float3 v[3] = {a, b, c};
+    float w[3];
+    for (int i = 0; i < 3; ++i) {
+        float3 p = v[(i + 1) % 3], q = v[(i + 2) % 3];
+        w[i] = (q.x - p.x) * (z - p.z) - (q.z - p.z) * (x - p.x);
+        bool top_left = (q.z - p.z) < 0.0f || ((q.z - p.z) == 0.0f && (q.x - p.x) > 0.0f);
+        if (w[i] < 0.0f || (w[i] == 0.0f && !top_left)) {
+            return false;
+        }
+    }
+    y = (w[0] * a.y + w[1] * b.y + w[2] * c.y) / area;
+    return true;
+}
+
+struct MeshVoxelizer {
+    const cmesh4::SimpleMesh &mesh;
+    const VoxelizeSettings &settings;
+    std::vector<float3> verts;          // voxel space
+    int3 chunk_min;
+    int3 chunk_count;
+
+    MeshVoxelizer(const cmesh4::SimpleMesh &mesh, const VoxelizeSettings &settings) : mesh(mesh), settings(settings) {}
+
+    int triangle_block(size_t t) const {
+        if (t < mesh.matIndices.size()) {
+            unsigned int m = mesh.matIndices[t];
+            if (m < settings.material_blocks.size()) {
+                return settings.material_blocks[m];
+            }
+        }
+        return settings.default_block;
+    }
+
+    void triangle(size_t t, float3 &a, float3 &b, float3 &c) const {
+        a = verts[mesh.indices[3 * t]];
+        b = verts[mesh.indices[3 * t + 1]];
+        c = verts[mesh.indices[3 * t + 2]];
+    }
+
+    int chunk_index(int3 c) const {
+        return ((c.x - chunk_min.x) * chunk_count.z + (c.z - chunk_min.z)) * chunk_count.y + (c.y - chunk_min.y);
+    }
+
+    static int floor_div(int a, int b) { return a >= 0 ? a / b : -((-a + b - 1) / b); }
+
+    // Voxels touched by the box [lo, hi] in voxel space
+    static void voxel_range(float3 lo, float3 hi, int3 &vmin, int3 &vmax) {
+        vmin = int3((int)std::floor(lo.x), (int)std::floor(lo.y), (int)std::floor(lo.z));
+        vmax = int3((int)std::floor(hi.x), (int)std::floor(hi.y), (int)std::floor(hi.z));
+    }
+
+    // Triangle ids per chunk (bins[chunk_index]) or per chunk column (bins[x * count.z + z])
+    void bin_triangles(std::vector<std::vector<uint32_t>> &bins, bool columns) const {
+        size_t tri_count = mesh.TrianglesNum();
+        bins.assign(columns ? chunk_count.x * chunk_count.z : chunk_count.x * chunk_count.y * chunk_count.z, {});
+        for (size_t t = 0; t < tri_count; ++t) {
+            float3 a, b, c;
+            triangle(t, a, b, c);
+            int3 vmin, vmax;
+            voxel_range(min(a, min(b, c)), max(a, max(b, c)), vmin, vmax);
+            int3 cmin = int3(floor_div(vmin.x, CHUNK_SIZE), floor_div(vmin.y, CHUNK_SIZE), floor_div(vmin.z, CHUNK_SIZE));
+            int3 cmax = int3(floor_div(vmax.x, CHUNK_SIZE), floor_div(vmax.y, CHUNK_SIZE), floor_div(vmax.z, CHUNK_SIZE));
+            cmin = max(cmin, chunk_min);
+            cmax = min(cmax, chunk_min + chunk_count - int3(1));
+            for (int cx = cmin.x; cx <= cmax.x; ++cx) {
+                for (int cz = cmin.z; cz <= cmax.z; ++cz) {
+                    if (columns) {
+                        bins[(cx - chunk_min.x) * chunk_count.z + (cz - chunk_min.z)].push_back((uint32_t)t);
+                        continue;
+                    }
+                    for (int cy = cmin.y; cy <= cmax.y; ++cy) {
+                        bins[chunk_index(int3(cx, cy, cz))].push_back((uint32_t)t);
+                    }
+                }
+            }
+        }
+    }
+
+    // Surface voxels of the triangles in bin, grid is CHUNK_SIZE^3 in grid_index layout
+    void rasterize(int3 chunk_origin, const std::vector<uint32_t> &bin, uint8_t *grid) const {
+        const float3 half = float3(0.5f);
+        for (uint32_t t : bin) {
+            float3 a, b, c;
+            triangle(t, a, b, c);
+            int3 vmin, vmax;
+            voxel_range(min(a, min(b, c)), max(a, max(b, c)), vmin, vmax);
+            vmin = max(vmin, chunk_origin);
+            vmax = min(vmax, chunk_origin + int3(CHUNK_SIZE - 1));
+            int block_id = triangle_block(t);
+            for (int x = vmin.x; x <= vmax.x; ++x) {
+                for (int z = vmin.z; z <= vmax.z; ++z) {
+                    for (int y = vmin.y; y <= vmax.y; ++y) {
+                        if (tri_box_overlap(float3(x, y, z) + half, half, a, b, c)) {
+                            int3 l = int3(x, y, z) - chunk_origin;
+                            grid[grid_index(l.x, l.y, l.z, CHUNK_SIZE)] = block_id;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Fills voxels whose centres lie between an entering and the following leaving crossing of the
+    // vertical line through their column, with the block of the entering triangle.
+    void fill_interior(int3 chunk_origin, const std::vector<uint32_t> &column_bin, uint8_t *grid) const {
+        struct Crossing {
+            float y;
+            int block_id;
+            bool operator<(const Crossing &other) const { return y < other.y; }
+        };
+        std::vector<std::vector<Crossing>> crossings(CHUNK_SIZE * CHUNK_SIZE);
+        for (uint32_t t : column_bin) {
+            float3 a, b, c;
+            triangle(t, a, b, c);
+            float3 lo = min(a, min(b, c)), hi = max(a, max(b, c));
+            int x0 = std::max((int)std::ceil(lo.x - 0.5f), chunk_origin.x);
+            int x1 = std::min((int)std::floor(hi.x - 0.5f), chunk_origin.x + CHUNK_SIZE - 1);
+            int z0 = std::max((int)std::ceil(lo.z - 0.5f), chunk_origin.z);
+            int z1 = std::min((int)std::floor(hi.z - 0.5f), chunk_origin.z + CHUNK_SIZE - 1);
+            int block_id = triangle_block(t);
+            for (int x = x0; x <= x1; ++x) {
+                for (int z = z0; z <= z1; ++z) {
+                    float y;
+                    if (vertical_crossing(x + 0.5f, z + 0.5f, a, b, c, y)) {
+                        crossings[(x - chunk_origin.x) * CHUNK_SIZE + (z - chunk_origin.z)].push_back({y, block_id});
+                    }
+                }
+            }
+        }
+
+        for (int x = 0; x < CHUNK_SIZE; ++x) {
+            for (int z = 0; z < CHUNK_SIZE; ++z) {
+                std::vector<Crossing> &list = crossings[x * CHUNK_SIZE + z];
+                std::sort(list.begin(), list.end());
+                uint8_t *column = grid + grid_index(x, 0, z, CHUNK_SIZE);
+                for (size_t i = 0; i + 1 < list.size(); i += 2) {
+                    int y0 = std::max((int)std::ceil(list[i].y - 0.5f) - chunk_origin.y, 0);
+                    int y1 = std::min((int)std::floor(list[i + 1].y - 0.5f) - chunk_origin.y, CHUNK_SIZE - 1);
+                    for (int y = y0; y <= y1; ++y) {
+                        if (column[y] == EMPTY) {
+                            column[y] = list[i].block_id;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    VoxelizedMesh run() {
+        VoxelizedMesh result;
+        if (mesh.TrianglesNum() == 0 || settings.voxel_size <= 0.0f) {
+            printf("[MeshVoxelizer::ERROR] Empty mesh or invalid voxel size\n");
+            return result;
+        }
+
+        float3 bmin = float3(1e30f), bmax = float3(-1e30f);
+        for (const auto &p : mesh.vPos4f) {
+            bmin = min(bmin, float3(p.x, p.y, p.z));
+            bmax = max(bmax, float3(p.x, p.y, p.z));
+        }
+        verts.resize(mesh.VerticesNum());
+        float inv_voxel = 1.0f / settings.voxel_size;
+        #pragma omp parallel for
+        for (int i = 0; i < (int)verts.size(); ++i) {
+            const auto &p = mesh.vPos4f[i];
+            verts[i] = (float3(p.x, p.y, p.z) - bmin) * inv_voxel + float3(settings.origin);
+        }
+
+        int3 vmin, vmax;
+        voxel_range(float3(settings.origin), (bmax - bmin) * inv_voxel + float3(settings.origin), vmin, vmax);
+        chunk_min = int3(floor_div(vmin.x, CHUNK_SIZE), floor_div(vmin.y, CHUNK_SIZE), floor_div(vmin.z, CHUNK_SIZE));
+        chunk_count = int3(floor_div(vmax.x, CHUNK_SIZE), floor_div(vmax.y, CHUNK_SIZE), floor_div(vmax.z, CHUNK_SIZE))
+            - chunk_min + int3(1);
+
+        std::vector<std::vector<uint32_t>> bins, column_bins;
+        bin_triangles(bins, false);
+        if (settings.solid_fill) {
+            bin_triangles(column_bins, true);
+        }
+
+        int total = chunk_count.x * chunk_count.y * chunk_count.z;
+        std::vector<SparseOctree> chunks(total);
+        std::vector<char> non_empty(total, 0);
+        #pragma omp parallel
+        {
+            std::vector<uint8_t> grid((size_t)CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE);
+            #pragma omp for schedule(dynamic)
+            for (int i = 0; i < total; ++i) {
+                int cy = i % chunk_count.y;
+                int cz = (i / chunk_count.y) % chunk_count.z;
+                int cx = i / (chunk_count.y * chunk_count.z);
+                int3 chunk_origin = (chunk_min + int3(cx, cy, cz)) * CHUNK_SIZE;
+                const std::vector<uint32_t> *column_bin = settings.solid_fill ? &column_bins[cx * chunk_count.z + cz] : nullptr;
+                if (bins[i].empty() && (!column_bin || column_bin->empty())) {
+                    continue;
+                }
+                std::fill(grid.begin(), grid.end(), (uint8_t)EMPTY);
+                rasterize(chunk_origin, bins[i], grid.data());
+                if (column_bin) {
+                    fill_interior(chunk_origin, *column_bin, grid.data());
+                }
+                if (std::any_of(grid.begin(), grid.end(), [](uint8_t b) { return b != EMPTY; })) {
+                    build_SO_grid(&chunks[i], grid.data(), CHUNK_SIZE);
+                    non_empty[i] = 1;
+                }
+            }
+        }
+
+        for (int i = 0; i < total; ++i) {
+            if (non_empty[i]) {
+                int cy = i % chunk_count.y;
+                int cz = (i / chunk_count.y) % chunk_count.z;
+                int cx = i / (chunk_count.y * chunk_count.z);
+                result.chunk_pos.push_back((chunk_min + int3(cx, cy, cz)) * CHUNK_SIZE);
+                result.chunks.push_back(std::move(chunks[i]));
+            }
+        }
+        return result;
+    }
+};
+
+// Converts a triangle mesh into the non-empty CHUNK_SIZE^3 chunks it covers
+VoxelizedMesh voxelize_mesh(const cmesh4::SimpleMesh &mesh, const VoxelizeSettings &settings) {
+    MeshVoxelizer voxelizer(mesh, settings);
+    return voxelizer.run();
+}